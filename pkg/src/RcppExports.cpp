@@ -1,22 +1,51 @@
 #include <Rcpp.h>
 #include <string>
+#include <vector>
 
 using namespace Rcpp;
 
-List ReadCSVColumns(std::string fileName, std::string columnSpec, int maxLineLength, bool hasHeaders, int numThreads);
+SEXP ReadCSVColumns(std::vector<std::string> fileNames, std::string columnSpec, int maxLineLength, bool hasHeaders, int numThreads,
+		    std::string dateFormat, std::string timeFormat, std::vector<std::string> trueValues,
+		    std::vector<std::string> falseValues, std::string outputType, std::string onError, int maxProblems, SEXP progress,
+		    bool pinThreads, bool computeStats, SEXP text, std::vector<std::string> selectNames, bool selectRegex,
+		    std::string selectTypes, bool lazyStrings, std::vector<std::string> sortKeys, bool sortRows,
+		    double maxMemory, std::vector<std::string> stringNA);
 
-RcppExport SEXP RReadCSVColumns(SEXP fileName, SEXP columnSpec, SEXP maxLineLength, SEXP hasHeaders, SEXP numThreads) 
+RcppExport SEXP RReadCSVColumns(SEXP fileNames, SEXP columnSpec, SEXP maxLineLength, SEXP hasHeaders, SEXP numThreads,
+		                SEXP dateFormat, SEXP timeFormat, SEXP trueValues, SEXP falseValues,
+				SEXP outputType, SEXP onError, SEXP maxProblems, SEXP progress, SEXP pinThreads,
+				SEXP computeStats, SEXP text, SEXP selectNames, SEXP selectRegex, SEXP selectTypes,
+				SEXP lazyStrings, SEXP sortKeys, SEXP sortRows, SEXP maxMemory, SEXP stringNA) 
 {
 BEGIN_RCPP
 
     SEXP __sexp_result;
     {
         Rcpp::RNGScope __rngScope;
-        List __result = ReadCSVColumns(Rcpp::as<std::string>(fileName), 
+        SEXP __result = ReadCSVColumns(Rcpp::as<std::vector<std::string> >(fileNames), 
 			               Rcpp::as<std::string>(columnSpec),
 				       Rcpp::as<int>(maxLineLength),
 				       Rcpp::as<bool>(hasHeaders),
-				       Rcpp::as<int>(numThreads));
+				       Rcpp::as<int>(numThreads),
+				       Rcpp::as<std::string>(dateFormat),
+				       Rcpp::as<std::string>(timeFormat),
+				       Rcpp::as<std::vector<std::string> >(trueValues),
+				       Rcpp::as<std::vector<std::string> >(falseValues),
+				       Rcpp::as<std::string>(outputType),
+				       Rcpp::as<std::string>(onError),
+				       Rcpp::as<int>(maxProblems),
+				       progress,
+				       Rcpp::as<bool>(pinThreads),
+				       Rcpp::as<bool>(computeStats),
+				       text,
+				       Rcpp::as<std::vector<std::string> >(selectNames),
+				       Rcpp::as<bool>(selectRegex),
+				       Rcpp::as<std::string>(selectTypes),
+				       Rcpp::as<bool>(lazyStrings),
+				       Rcpp::as<std::vector<std::string> >(sortKeys),
+				       Rcpp::as<bool>(sortRows),
+				       Rcpp::as<double>(maxMemory),
+				       Rcpp::as<std::vector<std::string> >(stringNA));
         PROTECT(__sexp_result = Rcpp::wrap(__result));
     }
     UNPROTECT(1);
@@ -25,3 +54,187 @@ BEGIN_RCPP
 END_RCPP
 }
 
+SEXP OpenCSVFollower(std::string fileName, std::string columnSpec, bool hasHeaders, std::string dateFormat, 
+		     std::string timeFormat, std::vector<std::string> trueValues, std::vector<std::string> falseValues);
+
+RcppExport SEXP ROpenCSVFollower(SEXP fileName, SEXP columnSpec, SEXP hasHeaders, SEXP dateFormat, SEXP timeFormat,
+				 SEXP trueValues, SEXP falseValues) 
+{
+BEGIN_RCPP
+
+    SEXP __sexp_result;
+    {
+        Rcpp::RNGScope __rngScope;
+        SEXP __result = OpenCSVFollower(Rcpp::as<std::string>(fileName), 
+				        Rcpp::as<std::string>(columnSpec),
+				        Rcpp::as<bool>(hasHeaders),
+				        Rcpp::as<std::string>(dateFormat),
+				        Rcpp::as<std::string>(timeFormat),
+				        Rcpp::as<std::vector<std::string> >(trueValues),
+				        Rcpp::as<std::vector<std::string> >(falseValues));
+        PROTECT(__sexp_result = Rcpp::wrap(__result));
+    }
+    UNPROTECT(1);
+    return __sexp_result;
+
+END_RCPP
+}
+
+SEXP ReadCSVFollower(SEXP followerPtr, int maxLineLength, int numThreads, std::string outputType, std::string onError,
+		     int maxProblems, bool pinThreads, bool computeStats);
+
+RcppExport SEXP RReadCSVFollower(SEXP followerPtr, SEXP maxLineLength, SEXP numThreads, SEXP outputType, SEXP onError,
+				 SEXP maxProblems, SEXP pinThreads, SEXP computeStats) 
+{
+BEGIN_RCPP
+
+    SEXP __sexp_result;
+    {
+        Rcpp::RNGScope __rngScope;
+        SEXP __result = ReadCSVFollower(followerPtr, 
+				        Rcpp::as<int>(maxLineLength),
+				        Rcpp::as<int>(numThreads),
+				        Rcpp::as<std::string>(outputType),
+				        Rcpp::as<std::string>(onError),
+				        Rcpp::as<int>(maxProblems),
+				        Rcpp::as<bool>(pinThreads),
+				        Rcpp::as<bool>(computeStats));
+        PROTECT(__sexp_result = Rcpp::wrap(__result));
+    }
+    UNPROTECT(1);
+    return __sexp_result;
+
+END_RCPP
+}
+
+SEXP ProbeCSVColumns(std::string fileName, std::string columnSpec, bool hasHeaders, std::string dateFormat, 
+		     std::string timeFormat);
+
+RcppExport SEXP RProbeCSVColumns(SEXP fileName, SEXP columnSpec, SEXP hasHeaders, SEXP dateFormat, SEXP timeFormat) 
+{
+BEGIN_RCPP
+
+    SEXP __sexp_result;
+    {
+        Rcpp::RNGScope __rngScope;
+        SEXP __result = ProbeCSVColumns(Rcpp::as<std::string>(fileName), 
+				        Rcpp::as<std::string>(columnSpec),
+				        Rcpp::as<bool>(hasHeaders),
+				        Rcpp::as<std::string>(dateFormat),
+				        Rcpp::as<std::string>(timeFormat));
+        PROTECT(__sexp_result = Rcpp::wrap(__result));
+    }
+    UNPROTECT(1);
+    return __sexp_result;
+
+END_RCPP
+}
+
+SEXP CountCSVRows(std::vector<std::string> fileNames, bool hasHeaders, int numThreads);
+
+RcppExport SEXP RCountCSVRows(SEXP fileNames, SEXP hasHeaders, SEXP numThreads) 
+{
+BEGIN_RCPP
+
+    SEXP __sexp_result;
+    {
+        Rcpp::RNGScope __rngScope;
+        SEXP __result = CountCSVRows(Rcpp::as<std::vector<std::string> >(fileNames), 
+				     Rcpp::as<bool>(hasHeaders),
+				     Rcpp::as<int>(numThreads));
+        PROTECT(__sexp_result = Rcpp::wrap(__result));
+    }
+    UNPROTECT(1);
+    return __sexp_result;
+
+END_RCPP
+}
+
+SEXP PartitionCSVFiles(std::vector<std::string> fileNames, std::string keyName, int keyCol, 
+		       std::vector<std::string> outputNames, bool hasHeaders, int numThreads, int maxLineLength);
+
+RcppExport SEXP RPartitionCSVFiles(SEXP fileNames, SEXP keyName, SEXP keyCol, SEXP outputNames, SEXP hasHeaders,
+				   SEXP numThreads, SEXP maxLineLength) 
+{
+BEGIN_RCPP
+
+    SEXP __sexp_result;
+    {
+        Rcpp::RNGScope __rngScope;
+        SEXP __result = PartitionCSVFiles(Rcpp::as<std::vector<std::string> >(fileNames), 
+				          Rcpp::as<std::string>(keyName),
+				          Rcpp::as<int>(keyCol),
+				          Rcpp::as<std::vector<std::string> >(outputNames),
+				          Rcpp::as<bool>(hasHeaders),
+				          Rcpp::as<int>(numThreads),
+				          Rcpp::as<int>(maxLineLength));
+        PROTECT(__sexp_result = Rcpp::wrap(__result));
+    }
+    UNPROTECT(1);
+    return __sexp_result;
+
+END_RCPP
+}
+
+SEXP AggregateCSVColumns(std::vector<std::string> fileNames, std::string columnSpec, std::vector<std::string> keyNames, 
+			 std::vector<std::string> functions, std::vector<std::string> aggregateColumns, 
+			 std::vector<std::string> aggregateNames, bool hasHeaders, int numThreads, int maxLineLength,
+			 std::string dateFormat, std::string timeFormat, std::vector<std::string> trueValues,
+			 std::vector<std::string> falseValues);
+
+RcppExport SEXP RAggregateCSVColumns(SEXP fileNames, SEXP columnSpec, SEXP keyNames, SEXP functions,
+				     SEXP aggregateColumns, SEXP aggregateNames, SEXP hasHeaders, SEXP numThreads,
+				     SEXP maxLineLength, SEXP dateFormat, SEXP timeFormat, SEXP trueValues,
+				     SEXP falseValues) 
+{
+BEGIN_RCPP
+
+    SEXP __sexp_result;
+    {
+        Rcpp::RNGScope __rngScope;
+        SEXP __result = AggregateCSVColumns(Rcpp::as<std::vector<std::string> >(fileNames), 
+				            Rcpp::as<std::string>(columnSpec),
+				            Rcpp::as<std::vector<std::string> >(keyNames),
+				            Rcpp::as<std::vector<std::string> >(functions),
+				            Rcpp::as<std::vector<std::string> >(aggregateColumns),
+				            Rcpp::as<std::vector<std::string> >(aggregateNames),
+				            Rcpp::as<bool>(hasHeaders),
+				            Rcpp::as<int>(numThreads),
+				            Rcpp::as<int>(maxLineLength),
+				            Rcpp::as<std::string>(dateFormat),
+				            Rcpp::as<std::string>(timeFormat),
+				            Rcpp::as<std::vector<std::string> >(trueValues),
+				            Rcpp::as<std::vector<std::string> >(falseValues));
+        PROTECT(__sexp_result = Rcpp::wrap(__result));
+    }
+    UNPROTECT(1);
+    return __sexp_result;
+
+END_RCPP
+}
+
+SEXP WriteCSVColumns(List columns, std::string columnSpec, std::vector<std::string> names, std::string fileName,
+		     bool hasHeader, int numThreads, std::string naString);
+
+RcppExport SEXP RWriteCSVColumns(SEXP columns, SEXP columnSpec, SEXP names, SEXP fileName, SEXP hasHeader,
+				 SEXP numThreads, SEXP naString) 
+{
+BEGIN_RCPP
+
+    SEXP __sexp_result;
+    {
+        Rcpp::RNGScope __rngScope;
+        SEXP __result = WriteCSVColumns(Rcpp::as<List>(columns), 
+				        Rcpp::as<std::string>(columnSpec),
+				        Rcpp::as<std::vector<std::string> >(names),
+				        Rcpp::as<std::string>(fileName),
+				        Rcpp::as<bool>(hasHeader),
+				        Rcpp::as<int>(numThreads),
+				        Rcpp::as<std::string>(naString));
+        PROTECT(__sexp_result = Rcpp::wrap(__result));
+    }
+    UNPROTECT(1);
+    return __sexp_result;
+
+END_RCPP
+}
@@ -1,121 +0,0 @@
-/*
-
-    This file is a part of the JThread package, which contains some object-
-    oriented thread wrappers for different thread implementations.
-
-    Copyright (c) 2000-2011  Jori Liesenborgs (jori.liesenborgs@gmail.com)
-
-    Permission is hereby granted, free of charge, to any person obtaining a
-    copy of this software and associated documentation files (the "Software"),
-    to deal in the Software without restriction, including without limitation
-    the rights to use, copy, modify, merge, publish, distribute, sublicense,
-    and/or sell copies of the Software, and to permit persons to whom the
-    Software is furnished to do so, subject to the following conditions:
-
-    The above copyright notice and this permission notice shall be included in
-    all copies or substantial portions of the Software.
-
-    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
-    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
-    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
-    DEALINGS IN THE SOFTWARE.
-
-*/
-
-#ifdef _WIN32
-
-#include "jmutex.h"
-
-namespace jthread
-{
-
-JMutex::JMutex()
-{
-	initialized = false;
-}
-
-JMutex::~JMutex()
-{
-	if (initialized)
-		DeleteCriticalSection(&mutex);
-}
-
-int JMutex::Init()
-{
-	if (initialized)
-		return ERR_JMUTEX_ALREADYINIT;
-	InitializeCriticalSection(&mutex);
-	initialized = true;
-	return 0;
-}
-
-int JMutex::Lock()
-{
-	if (!initialized)
-		return ERR_JMUTEX_NOTINIT;
-	EnterCriticalSection(&mutex);
-	return 0;
-}
-
-int JMutex::Unlock()
-{
-	if (!initialized)
-		return ERR_JMUTEX_NOTINIT;
-	LeaveCriticalSection(&mutex);
-	return 0;
-}
-
-} // end namespace
-
-#else
-
-#include "jmutex.h"
-
-namespace jthread
-{
-
-JMutex::JMutex()
-{
-	initialized = false;
-}
-
-JMutex::~JMutex()
-{
-	if (initialized)
-		pthread_mutex_destroy(&mutex);
-}
-
-int JMutex::Init()
-{
-	if (initialized)
-		return ERR_JMUTEX_ALREADYINIT;
-	
-	pthread_mutex_init(&mutex,NULL);
-	initialized = true;
-	return 0;	
-}
-
-int JMutex::Lock()
-{
-	if (!initialized)
-		return ERR_JMUTEX_NOTINIT;
-		
-	pthread_mutex_lock(&mutex);
-	return 0;
-}
-
-int JMutex::Unlock()
-{
-	if (!initialized)
-		return ERR_JMUTEX_NOTINIT;
-	
-	pthread_mutex_unlock(&mutex);
-	return 0;
-}
-
-} // end namespace
-
-#endif // _WIN32
@@ -3,93 +3,570 @@
 #endif // _WIN32
 
 #include <Rcpp.h>
+#include <Rversion.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include <vector>
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <regex>
+#include <unordered_map>
 
 #ifndef _WIN32
 #include <sys/mman.h>
 #include <unistd.h>
-#include "jthread.h"
-
-using namespace jthread;
 #endif // _WIN32
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif // __linux__
+
+// Lazily materialized string columns need the ALTREP interface, which is only
+// usable from R 3.6 on. Older versions of the header use 'class' as a name.
+#if defined(R_VERSION) && R_VERSION >= R_Version(3, 6, 0)
+#define HAVE_ALTREP
+#define class klass
+extern "C" {
+#include <R_ext/Altrep.h>
+}
+#undef class
+#endif // R_VERSION >= 3.6.0
+
 using namespace std;
 using namespace Rcpp;
 
-// The following two functions are slow, but are only used for the 
-// first line containing labels
+// The following two functions are only used for the first line containing
+// labels, but need to scale to files with tens of thousands of columns
 bool ReadInputLine(FILE *fi, string &line);
 void SplitLine(const string &line, vector<string> &args, const string &separatorChars,
 	       const string &quoteChars, const string &commentStartChars, bool ignoreZeroLengthFields);
-char *StrTok(char *pStr, char delim, char **pSavePtr);
+
+// Where the first lines come from, for the column names and type detection
+class LineSource
+{
+public:
+	virtual ~LineSource()						{ }
+	virtual bool readLine(string &line) = 0;
+	virtual bool rewind() = 0;
+};
+
+class FileLineSource : public LineSource
+{
+public:
+	FileLineSource(FILE *pFile) : m_pFile(pFile)			{ }
+	bool readLine(string &line)					{ return ReadInputLine(m_pFile, line); }
+	bool rewind()							{ return fseek(m_pFile, 0, SEEK_SET) == 0; }
+private:
+	FILE *m_pFile;
+};
+
+class MemoryLineSource : public LineSource
+{
+public:
+	MemoryLineSource(const char *pData, const char *pEnd) : m_pData(pData), m_pPos(pData), m_pEnd(pEnd) { }
+	bool readLine(string &line);
+	bool rewind()							{ m_pPos = m_pData; return true; }
+private:
+	const char *m_pData, *m_pPos, *m_pEnd;
+};
+
+// Hands the data lines to the single threaded parser, either from a file or
+// from memory. As with fgets, the line is cut off at bufferSize-1 bytes.
+class SerialLineReader
+{
+public:
+	SerialLineReader(FILE *pFile) : m_pFile(pFile), m_pPos(0), m_pEnd(0)			{ }
+	SerialLineReader(const char *pData, const char *pEnd) : m_pFile(0), m_pPos(pData), m_pEnd(pEnd)	{ }
+
+	bool next(char *pBuffer, int bufferSize, size_t &lineLength);
+	size_t getRemainingBytes() const;
+private:
+	FILE *m_pFile;
+	const char *m_pPos, *m_pEnd;
+};
+
+// Maps the text of a logical field onto TRUE, FALSE or NA. Each token of at most
+// eight bytes is packed into a 64-bit key, so that a lookup is a single hash and
+// integer compare instead of a series of string comparisons
+class LogicalTokens
+{
+public:
+	LogicalTokens();
+
+	void setTokens(const vector<string> &trueValues, const vector<string> &falseValues);
+	bool lookup(const char *pStr, int &value) const;
+private:
+	enum { TableBits = 6, TableSize = 1 << TableBits, MaxTokens = TableSize/2 };
+
+	static unsigned int slot(uint64_t key)				{ return (unsigned int)((key*0x9E3779B97F4A7C15ULL) >> (64-TableBits)); }
+	void insert(const string &token, int value);
+
+	uint64_t m_keys[TableSize];
+	int m_values[TableSize];
+	bool m_used[TableSize];
+	int m_numTokens;
+};
+
+// Set of distinct strings, kept per column and per thread. The worker threads
+// hash and deduplicate the strings they parse, so that the main thread only
+// needs to create a CHARSXP once for each distinct value. The strings are
+// stored back to back in one buffer, in order of first appearance.
+class StringPool
+{
+public:
+	StringPool();
+
+	int add(const char *pStr, size_t len);
+	int size() const						{ return (int)m_offsets.size(); }
+	const char *getString(int idx) const				{ return m_data.data() + m_offsets[idx]; }
+	int getLength(int idx) const					{ return m_lengths[idx]; }
+	size_t getTextBytes() const					{ return m_data.size(); }
+
+	SEXP createCharacterVector() const;
+	size_t getMemoryUsage() const;
+private:
+	static uint32_t hash(const char *pStr, size_t len);
+	void rehash(size_t newSize);
+	int append(const char *pStr, size_t len);
+
+	vector<char> m_data;
+	vector<size_t> m_offsets;
+	vector<int> m_lengths;
+	vector<uint32_t> m_hashes;
+	vector<int> m_table; // open addressing, -1 marks an empty slot
+	size_t m_lookups;
+	bool m_dedup;
+};
+
+// The data behind a string column whose CHARSXPs are only created when an
+// element is accessed: the distinct strings of each thread, and for each row
+// the index of its string counted over all these pools, or -1 for NA
+class LazyStrings
+{
+public:
+	LazyStrings() : m_numStrings(0)					{ }
+
+	// Returns the index of the first string of the pool
+	int addPool(StringPool &pool);
+	vector<int> &getRows()						{ return m_rows; }
+	size_t size() const						{ return m_rows.size(); }
+	void permute(const vector<int> &order);
+	SEXP getElement(size_t row) const;
+private:
+	vector<StringPool> m_pools;
+	vector<int> m_poolStart;
+	vector<int> m_rows;
+	size_t m_numStrings;
+};
+
+// Settings which are shared by all columns of a certain type
+struct ColumnOptions
+{
+	ColumnOptions() : hasStringNA(false)						{ }
+
+	string dateFormat, timeFormat;
+	LogicalTokens logicalTokens;
+	bool hasStringNA; // if set, string fields equal to stringNA become NA
+	string stringNA;
+};
+
+// Restricts the columns that are read to the ones with these names (or with
+// names matching these regular expressions) and these types
+struct ColumnSelection
+{
+	ColumnSelection() : useRegex(false)						{ }
+	bool empty() const								{ return names.empty() && types.empty(); }
+
+	vector<string> names;
+	bool useRegex;
+	string types;
+};
 
 class ValueVector
 {
 public:
-	enum VectorType { Ignore, Integer, Double, String };
+	enum VectorType { Ignore, Integer, Double, String, Date, DateTime, Logical };
 
 	ValueVector(VectorType t = Ignore);
 	~ValueVector();
 
 	void setType(VectorType t);
+	void setOptions(const ColumnOptions *pOptions)			{ m_pOptions = pOptions; }
+	VectorType getType() const					{ return m_vectorType; }
 	bool ignore() const 						{ return m_vectorType == Ignore; }
 
-	bool processWithCheck(const char *pStr, bool lastCol);
+	bool processWithCheck(const char *pStr);
+
+	// Type specific versions of processWithCheck, for when the type is already known
+	bool processInt(const char *pStr);
+	// For 'i' columns in a numeric matrix: checks for an integer, stores a double
+	bool processIntAsDouble(const char *pStr);
+	bool processLogical(const char *pStr);
+	bool processDouble(const char *pStr);
+	bool processDate(const char *pStr);
+	bool processDateTime(const char *pStr);
+	// Returns false if the field was the NA text of string columns
+	bool processString(const char *pStr, size_t len);
+	void addNA();
+
+	void addColumnToList(List &listOfVectors, int listPos);
+	SEXP allocateColumn(size_t totalEntries) const;
+	SEXP createDistinctStrings() const				{ return m_stringPool.createCharacterVector(); }
+	// For string columns that are materialized lazily: hands over the distinct
+	// strings, and copies the indices into them, offset by 'base'
+	void takeStringPool(StringPool &dest);
+	void copyStringIndices(int *pDest, size_t srcPos, size_t num, int base) const;
+	void copyToColumn(SEXP column, size_t destPos, size_t srcPos, size_t num, SEXP distinctStrings) const;
+	SEXP allocateMatrix(size_t numRows, int numCols) const;
+	void copyToMatrix(SEXP matrix, size_t totalRows, size_t destRow, size_t srcRow, size_t num, int numCols) const;
+
+	// These don't use the R API, so other threads can call them once the R
+	// vector has been allocated and its data pointer obtained
+	static void *getDataPointer(SEXP column);
+	void copyToBuffer(void *pDest, size_t destPos, size_t srcPos, size_t num) const;
+	void copyToMatrix(void *pMatrix, size_t totalRows, size_t destRow, size_t srcRow, size_t num, int numCols) const;
+	int getEntries() const;
 
-	void setName(const std::string &n) 				{ m_name = n; }
-	const string getName() const 					{ return m_name; }
+	// The value that was stored last, T is int or double depending on the type
+	template<class T> T lastValue() const;
+
+	// Makes room for a number of values up front, so that the staging vector
+	// doesn't need to be reallocated and copied over and over while parsing
+	void reserve(size_t numValues);
+	// Frees the staged values once they've been copied into the output
+	void release();
+	// Forgets the staged values, but keeps the memory for the next ones
+	void clear();
+	// The number of bytes that are allocated for the staged values
+	size_t getMemoryUsage() const;
+	// The number of bytes R needs for the distinct strings, i.e. for a CHARSXP
+	// per string and the vector that refers to them
+	size_t getStringMemoryUsage() const;
+	// The string that was stored last, returns false if it's NA
+	bool lastString(const char *&pStr, int &length) const;
 
-	void addColumnToList(List &listOfVectors);
-	void addColumnToList(List &listOfVectors, int numThreads, int thread, int totalEntries);
-	int getEntries() const;
-private:
 	static char *skipWhite(char *pStr);
 	static const char *skipWhite(const char *pStr);
+private:
 	static bool parseAsInt(const char *pStr, int &value);
 	static bool parseAsDouble(const char *pStr, double &value);
+	static bool parseAsDate(const char *pStr, const string &format, double &value);
+	static bool parseAsDateTime(const char *pStr, const string &format, double &value);
+	void setDateTimeClass(NumericVector &v) const;
 	
 	VectorType m_vectorType;
-	string m_name;
+	const ColumnOptions *m_pOptions;
 
-	vector<int> m_vectorInt;
+	vector<int> m_vectorInt; // also holds the StringPool indices for String columns
 	vector<double> m_vectorDouble;
-	vector<string> m_vectorString;
+	StringPool m_stringPool;
+};
+
+// A field that couldn't be interpreted, or a line that ended too soon, when
+// errors are replaced by NA
+struct Problem
+{
+	int fileIdx, col;
+	size_t chunkIdx, line; // in the parallel version, the line is relative to the chunk at first
+	bool missing;
+	string value;
+};
+
+// Collects the first 'maxProblems' problems, but counts all of them. A parser
+// thread doesn't necessarily handle its chunks in file order, so problems of an
+// earlier chunk can still replace the ones that were kept.
+class ProblemList
+{
+public:
+	ProblemList(size_t maxProblems) : m_maxProblems(maxProblems), m_total(0), m_firstUnassigned(0),
+	                                  m_chunkIdx(0), m_sorted(true) { }
+
+	// The chunk the lines that follow are part of, chunks have to be handled
+	// from start to end
+	void startChunk(size_t chunkIdx)				{ m_chunkIdx = chunkIdx; }
+	void add(int col, const char *pValue);
+	bool hasUnassigned() const					{ return m_firstUnassigned < m_problems.size(); }
+	void assignLine(int fileIdx, size_t chunkIdx, size_t line);
+
+	size_t getTotal() const						{ return m_total; }
+	vector<Problem> &getProblems()					{ keepFirst(); return m_problems; }
+private:
+	void keepFirst();
+
+	size_t m_maxProblems, m_total, m_firstUnassigned, m_chunkIdx;
+	bool m_sorted;
+	vector<Problem> m_problems;
+};
+
+// Statistics of a single column, gathered while parsing. Each thread keeps its
+// own, they're merged at the end. The number of distinct values is estimated
+// with a HyperLogLog sketch, so it needs a fixed amount of memory.
+class ColumnStats
+{
+public:
+	ColumnStats();
+
+	void add(int x);
+	void add(double x);
+	void addString(const char *pStr, size_t len);
+	void addNA()							{ m_numNA++; }
+	void merge(const ColumnStats &other);
+
+	bool hasValues() const						{ return m_numValues > 0; }
+	double getMin() const						{ return m_min; }
+	double getMax() const						{ return m_max; }
+	double getSum() const						{ return m_sum; }
+	size_t getNumNA() const						{ return m_numNA; }
+	int getMaxLength() const					{ return m_maxLength; }
+	double estimateDistinct() const;
+private:
+	static const int s_registerBits = 10;
+
+	void addHash(uint64_t h);
+	static uint64_t mix(uint64_t x);
+
+	double m_min, m_max, m_sum;
+	size_t m_numValues, m_numNA;
+	int m_maxLength;
+	vector<uint8_t> m_registers;
+};
+
+// Splits a line into fields and passes them on to the columns. The column
+// types are compiled into a parse plan once: consecutive columns of the same
+// type form a single step, handled by a kernel that is specialized for that
+// type, and runs of ignored columns are skipped without being tokenized. In
+// matrix mode, all fields that are read go to the same target, row after row.
+class LineParser
+{
+public:
+	// Without a problem list, parsing stops at the first field that can't be
+	// interpreted; with one, the problem is recorded and NA is stored instead.
+	// If pStats is set, it must point to one ColumnStats per column. In matrix
+	// mode, pColumns tells the type of each column, which can differ from the
+	// type of the matrix.
+	LineParser(const vector<ValueVector *> &targets, ProblemList *pProblems = 0, ColumnStats *pStats = 0,
+		   const vector<ValueVector> *pColumns = 0);
+
+	// The line ending is removed from pLine. On failure, pFailedField is NULL
+	// if the line doesn't contain enough columns.
+	bool parse(char *pLine, size_t lineLength, int &failedCol, const char *&pFailedField);
+private:
+	typedef bool (*FieldKernel)(ValueVector * const *ppTargets, ColumnStats *pStats, int numCols, char *&pPos,
+	                            int &failedIdx, const char *&pFailedField);
+
+	struct ParseStep
+	{
+		ParseStep(FieldKernel k, int first) : kernel(k), firstCol(first), numCols(1) { }
+
+		FieldKernel kernel;
+		int firstCol, numCols;
+	};
+
+	template<bool WithStats> static FieldKernel getKernel(ValueVector::VectorType t, ValueVector::VectorType columnType);
+
+	vector<ParseStep> m_plan;
+	vector<ValueVector *> m_targets;
+	ProblemList *m_pProblems;
+	ColumnStats *m_pStats;
+};
+
+// A range of complete lines in one of the input files
+struct Chunk
+{
+	Chunk(int f, const char *pData, int firstLine, const char *pS, const char *pE) 
+		: fileIdx(f), pDataStart(pData), firstLineNumber(firstLine), pStart(pS), pEnd(pE) { }
+
+	// Only needed to report the line number in case of an error
+	int lineNumber(const char *pLine) const;
+
+	int fileIdx;
+	const char *pDataStart; // the first line after the header
+	int firstLineNumber;
+	const char *pStart, *pEnd;
+};
+
+// Records which rows of a thread's columns came from which chunk
+struct ChunkResult
+{
+	ChunkResult(size_t c, size_t first, size_t n) : chunkIdx(c), firstRow(first), numRows(n) { }
+
+	size_t chunkIdx, firstRow, numRows;
+};
+
+// The digit counts of the sort key that is sorted on first, for the rows of one
+// chunk. They're gathered while parsing, so that the first radix sort pass over
+// that key doesn't need a pass of its own to count them.
+struct SortKeyCounts
+{
+	SortKeyCounts() : orBits(0), andBits(~(uint64_t)0)			{ }
+
+	void reset()
+	{
+		orBits = 0;
+		andBits = ~(uint64_t)0;
+		counts.assign(8*256, 0);
+	}
+
+	void add(uint64_t key)
+	{
+		orBits |= key;
+		andBits &= key;
+		for (int b = 0 ; b < 8 ; b++)
+			counts[b*256 + ((key >> (8*b)) & 0xFF)]++;
+	}
+
+	uint64_t orBits, andBits;
+	vector<uint32_t> counts; // 256 for each byte of the key, lowest byte first
 };
 
 #ifndef _WIN32
-class ParserThread : public JThread
+// Decides on which CPUs the parser threads may run. With pinning, the threads
+// are spread over the NUMA nodes in blocks, and each thread only runs on the
+// CPUs of its node, so that the memory it allocates stays local to it.
+class ThreadPlacement
+{
+public:
+	ThreadPlacement(int numThreads, bool pin);
+
+	// Each node that has threads gets its own range of chunks
+	int getNumRanges() const						{ return m_numRanges; }
+	int getRange(int thread) const						{ return m_threadRange[thread]; }
+	void pinCurrentThread(int thread) const;
+private:
+	static vector<vector<int> > getNodeCPUs();
+	static bool parseCPUList(const string &list, vector<int> &cpus);
+
+	bool m_pin;
+	int m_numRanges;
+	vector<int> m_threadRange;
+	vector<vector<int> > m_rangeCPUs;
+};
+
+// Hands out the chunks to the parser threads. The chunks are split into one
+// contiguous range per NUMA node; a thread takes chunks from its own range
+// first, and only then helps out with the others.
+class ChunkQueue
+{
+public:
+	// Only the chunks from 'begin' up to 'end' are handed out
+	ChunkQueue(const vector<Chunk> &c, size_t begin, size_t end, int numRanges);
+
+	bool getNext(int range, size_t &idx);
+
+	const vector<Chunk> &chunks;
+private:
+	struct Range
+	{
+		std::atomic<size_t> next;
+		size_t end;
+		char padding[64]; // keep the counters of different ranges apart
+	};
+
+	const int m_numRanges;
+	std::unique_ptr<Range[]> m_ranges;
+};
+
+// Lets the main thread sleep until all parser threads are done, while still
+// waking up regularly to check for a user interrupt
+class ThreadCompletion
 {
 public:
-	ParserThread(vector<ValueVector> &cols, string &errStr, int tNum, int threads,
-	             char *pStartStr, int nCols, bool hasHeaders, int maxLen,
-		     const string &colSpec, volatile bool &intr) 
-		: columns(cols), errorString(errStr), threadNum(tNum), numThreads(threads), 
-		  numCols(nCols), maxLineLength(maxLen), pStr(pStartStr), columnSpec(colSpec),
-		  interrupt(intr)
+	ThreadCompletion() : m_running(0)					{ }
+
+	void threadStarting()
 	{
-		lineNumber = (hasHeaders)?2:1;
-		m_endMutex.Init();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running++;
 	}
 
-	~ParserThread() { }
+	void threadDone()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running--;
+		m_condition.notify_one();
+	}
 
-	void runThread();
-	void *Thread();
+	// Returns true if all threads are done
+	bool waitFor(int milliseconds)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_condition.wait_for(lock, std::chrono::milliseconds(milliseconds), [this] { return m_running == 0; });
+	}
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	int m_running;
+};
+
+struct MergeInfo;
 
-	JMutex m_endMutex;
+// Everything a parser thread writes to while parsing. The object starts on a
+// cache line and its size is a multiple of one, so that none of this shares a
+// cache line with another thread's state.
+class alignas(64) ParserThread
+{
+public:
+	ParserThread(int idx, const string &colSpec, const ColumnOptions &options, bool asMatrix, 
+		     ValueVector::VectorType matrixType, ChunkQueue &queue, const ThreadPlacement &placement,
+		     const vector<string> &fNames, int maxLen, bool errorsAsNA, size_t maxProblems,
+		     size_t reserveRows, bool computeStats, int sortKeyCol, vector<SortKeyCounts> *pSortKeyCounts,
+		     std::atomic<bool> &intr, ThreadCompletion &completion);
+
+	// The entry point of the thread
+	void run();
+
+	// Copies the non-string columns of the chunks that this thread parsed into
+	// the output; run in a thread on the same NUMA node
+	void copyChunks(const MergeInfo &info);
+
+	vector<ValueVector> &getColumns()					{ return columns; }
+	ValueVector &getMatrixColumn()						{ return matrixColumn; }
+	const vector<ChunkResult> &getChunkResults() const			{ return chunkResults; }
+	ProblemList &getProblems()						{ return problems; }
+	const vector<ColumnStats> &getColumnStats() const			{ return columnStats; }
+	const string &getErrorString() const					{ return errorString; }
+	size_t getBytesDone() const						{ return bytesDone.load(std::memory_order_relaxed); }
+	size_t getMemoryUsage() const;
+
+	// Before C++17, plain new doesn't respect the alignment of the class
+	static void *operator new(size_t size);
+	static void operator delete(void *p);
 private:
-	vector<ValueVector> &columns;
-	string &errorString;
-	const int threadNum, numThreads, numCols, maxLineLength;
-	char *pStr;
-	int lineNumber;
+	void runThread();
+
+	const int threadIdx;
+	const ThreadPlacement &threadPlacement;
+	vector<ValueVector> columns;
+	ValueVector matrixColumn;
+	ProblemList problems;
+	vector<ColumnStats> columnStats;
+	LineParser lineParser;
+	string errorString;
+	ChunkQueue &chunkQueue;
+	const vector<string> &fileNames;
+	const int maxLineLength;
+	const size_t reservedRows;
 	string columnSpec;
-	volatile bool &interrupt;
+	const int sortKeyCol; // -1 if no counts are gathered
+	vector<SortKeyCounts> *pSortKeyCounts;
+	std::atomic<bool> &interrupt;
+	ThreadCompletion &threadCompletion;
+	vector<ChunkResult> chunkResults;
+	std::atomic<size_t> bytesDone; // only written by this thread, read for progress reports
 };
 #endif // !_WIN32
 
@@ -219,858 +696,4983 @@ inline bool ValueVector::parseAsDouble(const char *pStr, double &value)
 	return true;
 }
 
-inline int ValueVector::getEntries() const
+// Number of days since 1970-01-01 in the proleptic Gregorian calendar
+inline int daysFromCivil(int y, int m, int d)
 {
-	switch(m_vectorType)
-	{
-	case Ignore:
-		return 0;
-	case Integer:
-		return m_vectorInt.size();
-	case Double:
-		return m_vectorDouble.size();
-	case String:
-		return m_vectorString.size();
-	default:
-		throw Rcpp::exception("Internal error: unknown m_vectorType in getEntries");
-	}
+	y -= (m <= 2)?1:0;
+	const int era = ((y >= 0)?y:(y-399))/400;
+	const int yoe = y - era*400;
+	const int doy = (153*((m > 2)?(m-3):(m+9)) + 2)/5 + d-1;
+	const int doe = yoe*365 + yoe/4 - yoe/100 + doy;
+	return era*146097 + doe - 719468;
 }
 
-class AutoCloseFile
+inline bool isLeapYear(int y)
 {
-public:
-	AutoCloseFile(FILE *pFile) : m_pFile(pFile) 					{ }
-	~AutoCloseFile() 								{ if (m_pFile) fclose(m_pFile); }
-private:
-	FILE *m_pFile;
-};
+	return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
 
-#ifndef _WIN32
-class AutoUnMap
+inline int daysInMonth(int y, int m)
 {
-public:
-	AutoUnMap(void *pMmapAddr, size_t len) : m_pMmapAddr(pMmapAddr), m_len(len)	{ }
-	~AutoUnMap()									{ munmap(m_pMmapAddr, m_len); }
-private:
-	void *m_pMmapAddr;
-	size_t m_len;
-};
-#endif // !_WIN32
+	static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	if (m == 2 && isLeapYear(y))
+		return 29;
+	return days[m-1];
+}
 
-void Throw(const char *format, ...)
+// Reads exactly 'num' digits, used by the fixed-format ISO-8601 parser
+inline bool readDigits(const char *&pStr, int num, int &value)
 {
-#define MAXLEN 16384
-
-        va_list ap;
-	char buf[MAXLEN];
+	int v = 0;
+	for (int i = 0 ; i < num ; i++)
+	{
+		unsigned int d = (unsigned int)(pStr[i] - '0');
+		if (d > 9)
+			return false;
+		v = v*10 + (int)d;
+	}
+	pStr += num;
+	value = v;
+	return true;
+}
 
-        va_start(ap, format);
-        vsnprintf(buf, MAXLEN, format, ap);
-        va_end(ap);
+// Reads between one and 'maxNum' digits, used for user-specified formats
+inline bool readVarDigits(const char *&pStr, int maxNum, int &value)
+{
+	int v = 0, i = 0;
+	for ( ; i < maxNum ; i++)
+	{
+		unsigned int d = (unsigned int)(pStr[i] - '0');
+		if (d > 9)
+			break;
+		v = v*10 + (int)d;
+	}
+	if (i == 0)
+		return false;
+	pStr += i;
+	value = v;
+	return true;
+}
 
-	buf[MAXLEN-1] = 0;
-	throw Rcpp::exception(buf);
+inline bool isNAField(const char *pStr)
+{
+	if (pStr[0] == 'N' && pStr[1] == 'A')
+	{
+		char c = pStr[2];
+		if (c == '\0' || c == ' ' || c == '\t' || c == '\r' || c == '\n')
+			return true;
+	}
+	return false;
 }
 
-string getString(const char *format, ...)
+struct DateTimeFields
 {
-        va_list ap;
-	char buf[MAXLEN];
+	DateTimeFields() : year(1970), month(1), day(1), hour(0), minute(0), second(0), tzOffset(0) { }
 
-        va_start(ap, format);
-        vsnprintf(buf, MAXLEN, format, ap);
-        va_end(ap);
+	int year, month, day, hour, minute;
+	double second;
+	int tzOffset; // in seconds
 
-	buf[MAXLEN-1] = 0;
-	return string(buf);
+	bool valid() const
+	{
+		return month >= 1 && month <= 12 && day >= 1 && day <= daysInMonth(year, month) &&
+		       hour >= 0 && hour <= 24 && minute >= 0 && minute < 60 && second >= 0 && second < 61;
+	}
+	double days() const { return (double)daysFromCivil(year, month, day); }
+	double seconds() const { return days()*86400.0 + hour*3600.0 + minute*60.0 + second - tzOffset; }
+};
+
+inline bool parseFraction(const char *&pStr, double &value)
+{
+	// pStr points to the '.' or ','
+	double f = 0, scale = 0.1;
+	const char *p = pStr + 1;
+	unsigned int d;
+	if ((d = (unsigned int)(*p - '0')) > 9)
+		return false;
+	while ((d = (unsigned int)(*p - '0')) <= 9)
+	{
+		f += scale*d;
+		scale *= 0.1;
+		p++;
+	}
+	value += f;
+	pStr = p;
+	return true;
 }
 
-string GetColumnSpecAndColumnNames(string fileName, FILE *pFile, string columnSpec, bool hasHeaders, vector<string> &names)
+inline bool parseTimeZone(const char *&pStr, int &offset)
 {
-	names.clear();
-	string line;
+	if (*pStr == 'Z')
+	{
+		offset = 0;
+		pStr++;
+		return true;
+	}
+	if (*pStr != '+' && *pStr != '-')
+		return false;
 
-	if (!ReadInputLine(pFile, line))
-		Throw("Unable to read first line from file '%s'", fileName.c_str());
+	int sign = (*pStr == '-')?-1:1;
+	int h, m = 0;
+	const char *p = pStr + 1;
 
-	vector<string> parts;
-	SplitLine(line, parts, ",", "\"'", "", false);
+	if (!readDigits(p, 2, h))
+		return false;
+	if (*p == ':')
+		p++;
+	readDigits(p, 2, m); // minutes are optional
 
-	const size_t numCols = parts.size();
+	offset = sign*(h*3600 + m*60);
+	pStr = p;
+	return true;
+}
 
-	if (columnSpec.length() > 0)
+// Fixed-format YYYY-MM-DD[(T| )hh:mm[:ss[.fff]][Z|(+|-)hh[:mm]]]
+inline bool parseISO8601(const char *pStr, DateTimeFields &f, bool allowTime)
+{
+	if (!readDigits(pStr, 4, f.year) || *pStr++ != '-' || !readDigits(pStr, 2, f.month) ||
+	    *pStr++ != '-' || !readDigits(pStr, 2, f.day))
+		return false;
+
+	if (allowTime && (*pStr == 'T' || *pStr == ' ') && (unsigned int)(pStr[1] - '0') <= 9)
 	{
-		if (columnSpec.length() != numCols)
-			Throw("Number of columns in first line (%u) is not equal to the column specification length (%u)", parts.size(), columnSpec.length());
+		pStr++;
+		if (!readDigits(pStr, 2, f.hour) || *pStr++ != ':' || !readDigits(pStr, 2, f.minute))
+			return false;
 
-		if (!hasHeaders) // Need to rewind the file
+		if (*pStr == ':')
 		{
-			if (fseek(pFile, 0, SEEK_SET) != 0)
-				Throw("Unable to rewind the file (needed after checking number of columns)");
+			int s;
+			pStr++;
+			if (!readDigits(pStr, 2, s))
+				return false;
+			f.second = s;
+			if ((*pStr == '.' || *pStr == ',') && !parseFraction(pStr, f.second))
+				return false;
+		}
+		if (*pStr == 'Z' || *pStr == '+' || *pStr == '-')
+		{
+			if (!parseTimeZone(pStr, f.tzOffset))
+				return false;
 		}
 	}
-	else // try to guess the types
-	{
-		vector<string> guessParts = parts;		
 
-		if (hasHeaders) // In this case, we need the second line
-		{
-			if (!ReadInputLine(pFile, line))
-				Throw("Unable to read second line from file '%s' (needed to guess column types)", fileName.c_str());
+	pStr = ValueVector::skipWhite(pStr);
+	return *pStr == '\0' && f.valid();
+}
 
-			SplitLine(line, guessParts, ",", "", "", false);
-			
-			if (guessParts.size() != parts.size())
-				Throw("First and second line in '%s' do not contain the same number of columns (%u vs %u)", fileName.c_str(), parts.size(), guessParts.size());
+// A small subset of strptime: %Y %y %m %d %H %M %S %z %b %%. A space in the
+// format matches any amount of whitespace, other characters must match exactly
+inline bool parseWithFormat(const char *pStr, const char *pFmt, DateTimeFields &f)
+{
+	static const char *months[12] = { "jan", "feb", "mar", "apr", "may", "jun",
+		                          "jul", "aug", "sep", "oct", "nov", "dec" };
+	while (*pFmt)
+	{
+		char c = *pFmt++;
+		if (c == ' ')
+		{
+			pStr = ValueVector::skipWhite(pStr);
+			continue;
 		}
-
-		for (int i = 0 ; i < numCols ; i++)
+		if (c != '%')
 		{
-			ValueVector testVec;
-
-			testVec.setType(ValueVector::Integer);
-			if (testVec.processWithCheck(guessParts[i].c_str(), false))
-			{
-				columnSpec += "i";
-				continue;
-			}
+			if (*pStr++ != c)
+				return false;
+			continue;
+		}
 
-			testVec.setType(ValueVector::Double);
-			if (testVec.processWithCheck(guessParts[i].c_str(), false))
-			{
-				columnSpec += "r";
+		int s;
+		switch(*pFmt++)
+		{
+		case 'Y':
+			if (!readVarDigits(pStr, 4, f.year))
+				return false;
+			break;
+		case 'y':
+			if (!readVarDigits(pStr, 2, f.year))
+				return false;
+			f.year += (f.year < 69)?2000:1900;
+			break;
+		case 'm':
+			if (!readVarDigits(pStr, 2, f.month))
+				return false;
+			break;
+		case 'd':
+			if (!readVarDigits(pStr, 2, f.day))
+				return false;
+			break;
+		case 'H':
+			if (!readVarDigits(pStr, 2, f.hour))
+				return false;
+			break;
+		case 'M':
+			if (!readVarDigits(pStr, 2, f.minute))
+				return false;
+			break;
+		case 'S':
+			if (!readVarDigits(pStr, 2, s))
+				return false;
+			f.second = s;
+			if ((*pStr == '.' || *pStr == ',') && !parseFraction(pStr, f.second))
+				return false;
+			break;
+		case 'z':
+			if (!parseTimeZone(pStr, f.tzOffset))
+				return false;
+			break;
+		case 'b':
+			{
+				int m = 0;
+				for ( ; m < 12 ; m++)
+				{
+					if (tolower(pStr[0]) == months[m][0] && tolower(pStr[1]) == months[m][1] &&
+					    tolower(pStr[2]) == months[m][2])
+						break;
+				}
+				if (m == 12)
+					return false;
+				f.month = m+1;
+				pStr += 3;
+			}
+			break;
+		case '%':
+			if (*pStr++ != '%')
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	pStr = ValueVector::skipWhite(pStr);
+	return *pStr == '\0' && f.valid();
+}
+
+inline bool ValueVector::parseAsDate(const char *pStr, const string &format, double &value)
+{
+	pStr = skipWhite(pStr);
+	if (isNAField(pStr))
+	{
+		value = NA_REAL;
+		return true;
+	}
+
+	DateTimeFields f;
+	if (format.length() == 0)
+	{
+		if (!parseISO8601(pStr, f, false))
+			return false;
+	}
+	else if (!parseWithFormat(pStr, format.c_str(), f))
+		return false;
+
+	value = f.days();
+	return true;
+}
+
+inline bool ValueVector::parseAsDateTime(const char *pStr, const string &format, double &value)
+{
+	pStr = skipWhite(pStr);
+	if (isNAField(pStr))
+	{
+		value = NA_REAL;
+		return true;
+	}
+
+	DateTimeFields f;
+	if (format.length() == 0)
+	{
+		if (!parseISO8601(pStr, f, true))
+			return false;
+	}
+	else if (!parseWithFormat(pStr, format.c_str(), f))
+		return false;
+
+	value = f.seconds();
+	return true;
+}
+
+inline int ValueVector::getEntries() const
+{
+	switch(m_vectorType)
+	{
+	case Ignore:
+		return 0;
+	case Integer:
+	case Logical:
+		return m_vectorInt.size();
+	case Double:
+	case Date:
+	case DateTime:
+		return m_vectorDouble.size();
+	case String:
+		return m_vectorInt.size();
+	default:
+		throw Rcpp::exception("Internal error: unknown m_vectorType in getEntries");
+	}
+}
+
+template<> inline int ValueVector::lastValue<int>() const
+{
+	return m_vectorInt.back();
+}
+
+template<> inline double ValueVector::lastValue<double>() const
+{
+	return m_vectorDouble.back();
+}
+
+inline void ValueVector::reserve(size_t numValues)
+{
+	switch(m_vectorType)
+	{
+	case Ignore:
+		break;
+	case Integer:
+	case Logical:
+	case String:
+		m_vectorInt.reserve(numValues);
+		break;
+	case Double:
+	case Date:
+	case DateTime:
+		m_vectorDouble.reserve(numValues);
+		break;
+	default:
+		throw Rcpp::exception("Internal error: unknown m_vectorType in reserve");
+	}
+}
+
+inline void ValueVector::release()
+{
+	// Swapping with an empty vector is the only reliable way to give the memory back
+	vector<int>().swap(m_vectorInt);
+	vector<double>().swap(m_vectorDouble);
+	m_stringPool = StringPool();
+}
+
+inline void ValueVector::clear()
+{
+	m_vectorInt.clear();
+	m_vectorDouble.clear();
+	if (m_stringPool.size() > 0)
+		m_stringPool = StringPool();
+}
+
+inline size_t ValueVector::getMemoryUsage() const
+{
+	return m_vectorInt.capacity()*sizeof(int) + m_vectorDouble.capacity()*sizeof(double) + m_stringPool.getMemoryUsage();
+}
+
+// The header of a CHARSXP, plus its data being rounded up to a multiple of 8 bytes
+#define CHARSXP_OVERHEAD 56
+
+inline size_t ValueVector::getStringMemoryUsage() const
+{
+	return m_stringPool.size()*(CHARSXP_OVERHEAD + sizeof(SEXP)) + m_stringPool.getTextBytes();
+}
+
+inline bool ValueVector::lastString(const char *&pStr, int &length) const
+{
+	const int idx = m_vectorInt.back();
+	if (idx < 0)
+		return false;
+
+	pStr = m_stringPool.getString(idx);
+	length = m_stringPool.getLength(idx);
+	return true;
+}
+
+class AutoCloseFile
+{
+public:
+	AutoCloseFile(FILE *pFile) : m_pFile(pFile) 					{ }
+	~AutoCloseFile() 								{ if (m_pFile) fclose(m_pFile); }
+private:
+	FILE *m_pFile;
+};
+
+#ifndef _WIN32
+// Keeps track of the memory mapped input files and unmaps them when done
+class MappedFiles
+{
+public:
+	MappedFiles()									{ }
+	~MappedFiles()
+	{
+		for (size_t i = 0 ; i < m_addresses.size() ; i++)
+			munmap(m_addresses[i], m_lengths[i]);
+	}
+
+	// Maps the part of the file from 'offset' on, which is 'length' bytes long
+	const char *map(FILE *pFile, const string &fileName, size_t offset, size_t &length);
+private:
+	vector<void *> m_addresses;
+	vector<size_t> m_lengths;
+};
+#endif // !_WIN32
+
+void Throw(const char *format, ...)
+{
+#define MAXLEN 16384
+
+        va_list ap;
+	char buf[MAXLEN];
+
+        va_start(ap, format);
+        vsnprintf(buf, MAXLEN, format, ap);
+        va_end(ap);
+
+	buf[MAXLEN-1] = 0;
+	throw Rcpp::exception(buf);
+}
+
+string getString(const char *format, ...)
+{
+        va_list ap;
+	char buf[MAXLEN];
+
+        va_start(ap, format);
+        vsnprintf(buf, MAXLEN, format, ap);
+        va_end(ap);
+
+	buf[MAXLEN-1] = 0;
+	return string(buf);
+}
+
+void SetColumnType(ValueVector &column, char typeChar, const ColumnOptions &options)
+{
+	column.setOptions(&options);
+
+	switch(typeChar)
+	{
+	case 'i':
+		column.setType(ValueVector::Integer);
+		break;
+	case 'r':
+		column.setType(ValueVector::Double);
+		break;
+	case 's':
+		column.setType(ValueVector::String);
+		break;
+	case 'd':
+		column.setType(ValueVector::Date);
+		break;
+	case 't':
+		column.setType(ValueVector::DateTime);
+		break;
+	case 'l':
+		column.setType(ValueVector::Logical);
+		break;
+	case '.':
+		column.setType(ValueVector::Ignore);
+		break;
+	default:
+		Throw("Invalid column type '%c'", typeChar);
+	}
+}
+
+string GetColumnSpecAndColumnNames(string fileName, LineSource &source, string columnSpec, bool hasHeaders, 
+		                   const ColumnOptions &options, vector<string> &names, bool reportSpec = true)
+{
+	names.clear();
+	string line;
+
+	if (!source.readLine(line))
+		Throw("Unable to read first line from file '%s'", fileName.c_str());
+
+	vector<string> parts;
+	SplitLine(line, parts, ",", "\"'", "", false);
+
+	const size_t numCols = parts.size();
+
+	if (columnSpec.length() > 0)
+	{
+		if (columnSpec.length() != numCols)
+			Throw("Number of columns in first line (%u) is not equal to the column specification length (%u)", parts.size(), columnSpec.length());
+
+		if (!hasHeaders) // Need to rewind the file
+		{
+			if (!source.rewind())
+				Throw("Unable to rewind the file (needed after checking number of columns)");
+		}
+	}
+	else // try to guess the types
+	{
+		vector<string> guessParts = parts;		
+
+		if (hasHeaders) // In this case, we need the second line
+		{
+			if (!source.readLine(line))
+				Throw("Unable to read second line from file '%s' (needed to guess column types)", fileName.c_str());
+
+			SplitLine(line, guessParts, ",", "", "", false);
+			
+			if (guessParts.size() != parts.size())
+				Throw("First and second line in '%s' do not contain the same number of columns (%u vs %u)", fileName.c_str(), parts.size(), guessParts.size());
+		}
+
+		for (int i = 0 ; i < numCols ; i++)
+		{
+			ValueVector testVec;
+
+			testVec.setType(ValueVector::Integer);
+			if (testVec.processWithCheck(guessParts[i].c_str()))
+			{
+				columnSpec += "i";
+				continue;
+			}
+
+			testVec.setType(ValueVector::Double);
+			if (testVec.processWithCheck(guessParts[i].c_str()))
+			{
+				columnSpec += "r";
+				continue;
+			}
+
+			// Logical columns aren't guessed: with tokens like 'no' or 'F', a single
+			// line says too little to tell them from a string column
+			SetColumnType(testVec, 'd', options);
+			if (testVec.processWithCheck(guessParts[i].c_str()))
+			{
+				columnSpec += "d";
 				continue;
 			}
 
-			// If neither integer nor double works, lets use a string
-			columnSpec += "s";
-		}
+			SetColumnType(testVec, 't', options);
+			if (testVec.processWithCheck(guessParts[i].c_str()))
+			{
+				columnSpec += "t";
+				continue;
+			}
+
+			// If none of these work, lets use a string
+			columnSpec += "s";
+		}
+
+		if (reportSpec)
+			Rcout << "Detected column specification is '" << columnSpec << "'" << endl;
+
+		if (!source.rewind())
+			Throw("Unable to rewind the file (needed after establising the column types)");
+
+		if (hasHeaders)
+		{
+			// In this case, we need to skip the first line again
+			if (!source.readLine(line))
+				Throw("Unable to re-read the first line (needed after establising the column types)");
+		}
+	}
+
+	if (hasHeaders)
+		names = parts;
+	else // Use default column names
+	{
+		char tmp[1024];
+		
+		names.clear();
+		for (int i = 1 ; i <= (int)parts.size() ; i++)
+		{
+			sprintf(tmp, "col_%03d", i);
+			names.push_back(tmp);
+		}
+	}
+
+	return columnSpec;
+}
+
+string GetColumnSpecAndColumnNames(string fileName, FILE *pFile, string columnSpec, bool hasHeaders, 
+		                   const ColumnOptions &options, vector<string> &names)
+{
+	FileLineSource source(pFile);
+	return GetColumnSpecAndColumnNames(fileName, source, columnSpec, hasHeaders, options, names);
+}
+
+string SelectColumns(const string &fileName, string columnSpec, const vector<string> &names, 
+		     const ColumnSelection &selection)
+{
+	const size_t numCols = columnSpec.length();
+	vector<bool> selected(numCols, selection.names.empty());
+
+	for (size_t s = 0 ; s < selection.names.size() ; s++)
+	{
+		const string &selectName = selection.names[s];
+		bool found = false;
+
+		if (selection.useRegex)
+		{
+			std::regex pattern;
+			try
+			{
+				pattern.assign(selectName, std::regex::extended);
+			}
+			catch (std::regex_error &e)
+			{
+				Throw("Invalid regular expression '%s': %s", selectName.c_str(), e.what());
+			}
+
+			for (size_t i = 0 ; i < numCols ; i++)
+			{
+				if (std::regex_search(names[i], pattern))
+					selected[i] = found = true;
+			}
+
+			if (!found)
+				Throw("None of the column names in '%s' match '%s'", fileName.c_str(), selectName.c_str());
+		}
+		else
+		{
+			for (size_t i = 0 ; i < numCols ; i++)
+			{
+				if (names[i] == selectName)
+					selected[i] = found = true;
+			}
+
+			if (!found)
+				Throw("There is no column named '%s' in '%s'", selectName.c_str(), fileName.c_str());
+		}
+	}
+
+	for (size_t i = 0 ; i < selection.types.length() ; i++)
+	{
+		if (strchr("irsldt", selection.types[i]) == 0)
+			Throw("Invalid column type '%c' in the types to select", selection.types[i]);
+	}
+
+	for (size_t i = 0 ; i < numCols ; i++)
+	{
+		if (!selected[i] || (selection.types.length() > 0 && selection.types.find(columnSpec[i]) == string::npos))
+			columnSpec[i] = '.';
+	}
+	return columnSpec;
+}
+
+// A data.frame only needs a class and the compact c(NA, -numRows) form of
+// the row names; setting these here avoids the checks and possible copies
+// that as.data.frame would do afterwards
+void SetOutputClass(List &listOfVectors, const string &outputType, int numRows)
+{
+	if (outputType == "list")
+		return;
+
+	IntegerVector rowNames(2);
+	rowNames[0] = NA_INTEGER;
+	rowNames[1] = -numRows;
+	listOfVectors.attr("row.names") = rowNames;
+
+	if (outputType == "data.table")
+		listOfVectors.attr("class") = CharacterVector::create("data.table", "data.frame");
+	else
+		listOfVectors.attr("class") = "data.frame";
+}
+
+#ifndef _WIN32
+const char *MappedFiles::map(FILE *pFile, const string &fileName, size_t offset, size_t &length)
+{
+	int fileDesc = fileno(pFile);
+	if (fileDesc < 0)
+		Throw("Internal error: unable to get file descriptor of opened file");
+
+	if (fseek(pFile, 0, SEEK_END) != 0)
+		Throw("Couldn't seek to the end of the file '%s'", fileName.c_str());
+
+	long len = ftell(pFile);
+	if (len < 0)
+		Throw("Unable to determine the size of '%s'", fileName.c_str());
+
+	const size_t fileSize = (size_t)len;
+	if (offset > fileSize)
+		Throw("The file '%s' is smaller than before, it may have been truncated or replaced", fileName.c_str());
+
+	length = fileSize - offset;
+	if (length == 0)
+		return "";
+
+	// The mapping has to start at a page boundary
+	const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t mapOffset = offset - (offset % pageSize);
+	const size_t mapLength = fileSize - mapOffset;
+
+	// The parser threads never read beyond the end of the mapped region, so
+	// there's no need for the mapping to be zero-terminated
+	void *pMmapAddr = mmap(0, mapLength, PROT_READ, MAP_PRIVATE, fileDesc, (off_t)mapOffset);
+	if (pMmapAddr == MAP_FAILED)
+		Throw("Unable to use 'mmap' to access file '%s'", fileName.c_str());
+
+	m_addresses.push_back(pMmapAddr);
+	m_lengths.push_back(mapLength);
+	return (const char *)pMmapAddr + (offset - mapOffset);
+}
+#endif // !_WIN32
+
+int Chunk::lineNumber(const char *pLine) const
+{
+	int line = firstLineNumber;
+	const char *pStr = pDataStart;
+	while (pStr < pLine)
+	{
+		const char *pNewLine = (const char *)memchr(pStr, '\n', pLine - pStr);
+		if (!pNewLine)
+			break;
+		line++;
+		pStr = pNewLine + 1;
+	}
+	return line;
+}
+
+// A follower opens the file in binary mode, so that its byte offsets stay valid
+// on Windows, where text mode turns CR LF into LF
+FILE *OpenInputFile(const string &fileName, bool binary = false)
+{
+	FILE *pFile = fopen(fileName.c_str(), (binary)?"rb":"rt");
+	if (!pFile)
+		Throw("Unable to open file '%s'", fileName.c_str());
+	return pFile;
+}
+
+// Skips the header of one of the other input files, checking that it matches
+// the one of the first file
+void CheckFileHeader(const string &fileName, FILE *pFile, const string &columnSpec, bool hasHeaders,
+		     const ColumnOptions &options, const vector<string> &names, const string &firstFileName)
+{
+	vector<string> fileColumnNames;
+	GetColumnSpecAndColumnNames(fileName, pFile, columnSpec, hasHeaders, options, fileColumnNames);
+
+	if (hasHeaders && fileColumnNames != names)
+		Throw("The column names in '%s' differ from the ones in '%s'", fileName.c_str(), firstFileName.c_str());
+}
+
+#ifndef _WIN32
+// Splits the lines in [pData, pEnd) into chunks of roughly chunkSize bytes
+void AddChunks(int fileIdx, const char *pData, const char *pEnd, int firstLineNumber, size_t chunkSize,
+	       vector<Chunk> &chunks)
+{
+	const char *pStart = pData;
+	while (pStart < pEnd)
+	{
+		const char *pStop = pEnd;
+		if ((size_t)(pEnd - pStart) > chunkSize)
+		{
+			const char *pSearch = pStart + chunkSize - 1;
+			const char *pNewLine = (const char *)memchr(pSearch, '\n', pEnd - pSearch);
+			if (pNewLine)
+				pStop = pNewLine + 1;
+		}
+
+		chunks.push_back(Chunk(fileIdx, pData, firstLineNumber, pStart, pStop));
+		pStart = pStop;
+	}
+}
+
+// Estimates the number of lines in totalBytes of data, from the average line
+// length in a sample at the start of the data
+size_t EstimateRows(const char *pSample, size_t sampleSize, size_t totalBytes)
+{
+	sampleSize = std::min(sampleSize, (size_t)65536);
+
+	size_t numLines = 0;
+	size_t sampledBytes = 0;
+	const char *pEnd = pSample + sampleSize;
+	const char *pPos = pSample;
+	const char *pNewLine;
+
+	while ((pNewLine = (const char *)memchr(pPos, '\n', pEnd - pPos)) != 0)
+	{
+		numLines++;
+		pPos = pNewLine + 1;
+		sampledBytes = pPos - pSample;
+	}
+
+	if (numLines == 0)
+		return 0;
+
+	return (size_t)((double)totalBytes * numLines / sampledBytes);
+}
+#endif // !_WIN32
+
+// Returns the number of bytes between the current position and the end of
+// the file, or 0 if that can't be determined
+size_t GetRemainingBytes(FILE *pFile)
+{
+	struct stat fileInfo;
+	if (fstat(fileno(pFile), &fileInfo) != 0)
+		return 0;
+
+	long pos = ftell(pFile);
+	if (pos < 0 || (double)pos > (double)fileInfo.st_size)
+		return 0;
+
+	return (size_t)(fileInfo.st_size - pos);
+}
+
+// Returns the size of the files, counting the ones that can't be examined as empty
+size_t GetFileSizes(const vector<string> &fileNames, size_t first, size_t end)
+{
+	size_t totalBytes = 0;
+	for (size_t f = first ; f < end ; f++)
+	{
+		struct stat fileInfo;
+		if (stat(fileNames[f].c_str(), &fileInfo) == 0)
+			totalBytes += fileInfo.st_size;
+	}
+	return totalBytes;
+}
+
+inline bool SerialLineReader::next(char *pBuffer, int bufferSize, size_t &lineLength)
+{
+	if (m_pFile)
+	{
+		if (!fgets(pBuffer, bufferSize, m_pFile))
+			return false;
+
+		pBuffer[bufferSize-1] = 0;
+		lineLength = strlen(pBuffer);
+		return true;
+	}
+
+	if (m_pPos >= m_pEnd)
+		return false;
+
+	const char *pNewLine = (const char *)memchr(m_pPos, '\n', m_pEnd - m_pPos);
+	const char *pNext = (pNewLine)?(pNewLine + 1):m_pEnd;
+
+	lineLength = std::min((size_t)(pNext - m_pPos), (size_t)(bufferSize-1));
+	memcpy(pBuffer, m_pPos, lineLength);
+	pBuffer[lineLength] = 0;
+
+	m_pPos = pNext;
+	return true;
+}
+
+size_t SerialLineReader::getRemainingBytes() const
+{
+	if (m_pFile)
+		return GetRemainingBytes(m_pFile);
+	return m_pEnd - m_pPos;
+}
+
+// Returns the start of the second line, or pEnd if there's only one line
+const char *SkipFirstLine(const char *pData, const char *pEnd)
+{
+	const char *pNewLine = (const char *)memchr(pData, '\n', pEnd - pData);
+	return (pNewLine)?(pNewLine + 1):pEnd;
+}
+
+// In-memory data is parsed where it is, the R object stays protected for as
+// long as the .Call is running
+const char *GetTextData(SEXP text, size_t &length)
+{
+	if (TYPEOF(text) == RAWSXP)
+	{
+		length = XLENGTH(text);
+		return (const char *)RAW(text);
+	}
+
+	if (TYPEOF(text) == STRSXP && XLENGTH(text) == 1 && STRING_ELT(text, 0) != NA_STRING)
+	{
+		SEXP str = STRING_ELT(text, 0);
+		length = LENGTH(str);
+		return CHAR(str);
+	}
+
+	Throw("The text to parse must be a raw vector or a single string");
+	return 0;
+}
+
+// A matrix can be returned if only integer and real columns are read, the result
+// is a real matrix if there's at least one real column
+ValueVector::VectorType GetMatrixType(const string &columnSpec)
+{
+	ValueVector::VectorType t = ValueVector::Integer;
+	for (size_t i = 0 ; i < columnSpec.length() ; i++)
+	{
+		if (columnSpec[i] == 'r')
+			t = ValueVector::Double;
+		else if (columnSpec[i] != 'i' && columnSpec[i] != '.')
+			Throw("A matrix can only be returned for 'i' and 'r' columns, not for '%c'", columnSpec[i]);
+	}
+	return t;
+}
+
+vector<ValueVector> CreateColumns(const string &columnSpec, const ColumnOptions &options)
+{
+	vector<ValueVector> columns(columnSpec.length());
+	for (size_t i = 0 ; i < columns.size() ; i++)
+		SetColumnType(columns[i], columnSpec[i], options);
+	return columns;
+}
+
+vector<ValueVector *> GetParseTargets(vector<ValueVector> &columns, ValueVector &matrixColumn, bool asMatrix)
+{
+	vector<ValueVector *> targets(columns.size());
+	for (size_t i = 0 ; i < columns.size() ; i++)
+		targets[i] = (asMatrix && !columns[i].ignore())?(&matrixColumn):(&columns[i]);
+	return targets;
+}
+
+bool CompareProblems(const Problem &a, const Problem &b)
+{
+	if (a.fileIdx != b.fileIdx)
+		return a.fileIdx < b.fileIdx;
+	if (a.line != b.line)
+		return a.line < b.line;
+	return a.col < b.col;
+}
+
+// Builds a data frame with the first 'maxProblems' problems in file order, the
+// total number of problems is stored in its 'total' attribute
+List CreateProblemTable(vector<Problem> &problems, size_t maxProblems, size_t totalProblems, 
+		        const vector<string> &fileNames, const string &columnSpec, const vector<string> &names)
+{
+	std::sort(problems.begin(), problems.end(), CompareProblems);
+	if (problems.size() > maxProblems)
+		problems.resize(maxProblems);
+
+	const size_t num = problems.size();
+	CharacterVector file(num), column(num), expected(num), value(num);
+	IntegerVector line(num);
+
+	for (size_t i = 0 ; i < num ; i++)
+	{
+		const Problem &p = problems[i];
+		file[i] = fileNames[p.fileIdx];
+		line[i] = (int)p.line;
+		column[i] = names[p.col];
+		if (p.missing)
+		{
+			expected[i] = "more columns";
+			value[i] = NA_STRING;
+		}
+		else
+		{
+			expected[i] = string(1, columnSpec[p.col]);
+			value[i] = p.value;
+		}
+	}
+
+	List table(5);
+	table[0] = file;
+	table[1] = line;
+	table[2] = column;
+	table[3] = expected;
+	table[4] = value;
+	table.attr("names") = CharacterVector::create("file", "line", "column", "expected", "value");
+	SetOutputClass(table, "data.frame", (int)num);
+	table.attr("total") = (double)totalProblems;
+	return table;
+}
+
+// One row per column that was read. Statistics that don't apply to a column's
+// type, or to a column without any values, are NA.
+List CreateStatsTable(const vector<ColumnStats> &stats, const string &columnSpec, const vector<string> &names)
+{
+	const int num = (int)(columnSpec.length() - std::count(columnSpec.begin(), columnSpec.end(), '.'));
+	CharacterVector column(num);
+	NumericVector minimum(num), maximum(num), sum(num), numNA(num), distinct(num);
+	IntegerVector maxLength(num);
+
+	int row = 0;
+	for (size_t i = 0 ; i < columnSpec.length() ; i++)
+	{
+		if (columnSpec[i] == '.')
+			continue;
+
+		const ColumnStats &c = stats[i];
+		const bool numeric = (columnSpec[i] != 's');
+
+		column[row] = names[i];
+		minimum[row] = (numeric && c.hasValues())?c.getMin():NA_REAL;
+		maximum[row] = (numeric && c.hasValues())?c.getMax():NA_REAL;
+		sum[row] = (numeric)?c.getSum():NA_REAL;
+		numNA[row] = (double)c.getNumNA();
+		distinct[row] = c.estimateDistinct();
+		maxLength[row] = (numeric)?NA_INTEGER:c.getMaxLength();
+		row++;
+	}
+
+	List table(7);
+	table[0] = column;
+	table[1] = minimum;
+	table[2] = maximum;
+	table[3] = sum;
+	table[4] = numNA;
+	table[5] = distinct;
+	table[6] = maxLength;
+	table.attr("names") = CharacterVector::create("column", "min", "max", "sum", "na.count", "distinct", "max.length");
+	SetOutputClass(table, "data.frame", num);
+	return table;
+}
+
+void CheckInterruptCallback(void *)
+{
+	R_CheckUserInterrupt();
+}
+
+// R_CheckUserInterrupt doesn't return when the user pressed Ctrl-C, which would
+// skip all destructors, so it's run in its own top level context
+bool UserInterruptPending()
+{
+	return (R_ToplevelExec(CheckInterruptCallback, NULL) == FALSE);
+}
+
+struct ProgressCall
+{
+	SEXP function;
+	double bytesDone;
+};
+
+void ProgressCallback(void *pData)
+{
+	ProgressCall *pCall = (ProgressCall *)pData;
+	SEXP bytesDone = PROTECT(Rf_ScalarReal(pCall->bytesDone));
+	SEXP call = PROTECT(Rf_lang2(pCall->function, bytesDone));
+	Rf_eval(call, R_GlobalEnv);
+	UNPROTECT(2);
+}
+
+// Calls the progress function with the number of bytes that have been parsed,
+// if one was specified. Returns false if the function raised an error.
+bool ReportProgress(SEXP progress, double bytesDone)
+{
+	if (Rf_isNull(progress))
+		return true;
+
+	ProgressCall call = { progress, bytesDone };
+	return (R_ToplevelExec(ProgressCallback, &call) == TRUE);
+}
+
+#ifndef _WIN32
+// Where the parsed rows need to go; the R vectors are allocated beforehand
+struct MergeInfo
+{
+	MergeInfo(const vector<int> &cThread, const vector<size_t> &cFirstRow, const vector<size_t> &cRows,
+		  const vector<size_t> &cOutPos) 
+		: chunkThread(cThread), chunkFirstRow(cFirstRow), chunkRows(cRows), chunkOutPos(cOutPos),
+		  pMatrixData(0), totalRows(0), numMatrixCols(0) { }
+
+	const vector<int> &chunkThread;
+	const vector<size_t> &chunkFirstRow, &chunkRows, &chunkOutPos;
+	vector<void *> columnData; // NULL for ignored and string columns
+	void *pMatrixData;
+	size_t totalRows;
+	int numMatrixCols;
+};
+
+// Only the main thread may call R, so it waits for the parser threads in steps
+// of 100ms. When the user interrupts or the progress function fails, the threads
+// are asked to stop and 'errorString' describes the reason. The progress includes the
+// 'bytesBefore' that were parsed by earlier batches.
+void WaitForParserThreads(const vector<std::unique_ptr<ParserThread> > &threads, ThreadCompletion &completion,
+			  std::atomic<bool> &interrupt, SEXP progress, double bytesBefore, string &errorString)
+{
+	while (!completion.waitFor(100))
+	{
+		if (errorString.length() > 0) // Already stopping
+			continue;
+
+		if (UserInterruptPending())
+			errorString = "Reading was interrupted by the user";
+		else
+		{
+			double bytesDone = bytesBefore;
+			for (size_t i = 0 ; i < threads.size() ; i++)
+				bytesDone += threads[i]->getBytesDone();
+
+			if (!ReportProgress(progress, bytesDone))
+				errorString = "The progress function failed";
+		}
+
+		if (errorString.length() > 0)
+			interrupt = true;
+	}
+}
+
+size_t CountNewLines(const char *pData, size_t length, int numThreads);
+#endif // !_WIN32
+
+SEXP ReadColumns(const vector<string> &fileNames, const char *pText, size_t textLength, int firstLineNumber,
+		 const vector<string> *pColumnNames, string columnSpec, const ColumnSelection &selection,
+		 int maxLineLength, bool hasHeaders, 
+		 int numThreads, const ColumnOptions &options, const string &outputType, const string &onError, 
+		 int maxProblems, SEXP progress, bool pinThreads, bool computeStats, bool lazyStrings,
+		 const vector<string> &sortKeys, bool sortRows, double maxMemory);
+
+#ifdef HAVE_ALTREP
+SEXP CreateLazyStringColumn(const vector<ValueVector *> &threadColumns, const vector<int> &chunkThread,
+			    const vector<size_t> &chunkFirstRow, const vector<size_t> &chunkRows, size_t totalRows);
+bool PermuteLazyStrings(SEXP column, const vector<int> &order);
+#else
+// Without ALTREP, lazyStrings is always false and this isn't called
+inline SEXP CreateLazyStringColumn(const vector<ValueVector *> &threadColumns, const vector<int> &chunkThread,
+				   const vector<size_t> &chunkFirstRow, const vector<size_t> &chunkRows, size_t totalRows)
+{
+	throw Rcpp::exception("Internal error: lazy string columns are not available");
+}
+
+inline bool PermuteLazyStrings(SEXP column, const vector<int> &order)	{ return false; }
+#endif // HAVE_ALTREP
+
+// Calls f(0) up to f(numThreads-1), each in a thread of its own
+template<class F>
+void RunInThreads(int numThreads, F f)
+{
+	vector<std::thread> threads;
+	try
+	{
+		for (int t = 1 ; t < numThreads ; t++)
+			threads.push_back(std::thread(f, t));
+	}
+	catch (const std::exception &e)
+	{
+		for (size_t t = 0 ; t < threads.size() ; t++)
+			threads[t].join();
+		Throw("Unable to start a thread: %s", e.what());
+	}
+
+	f(0);
+	for (size_t t = 0 ; t < threads.size() ; t++)
+		threads[t].join();
+}
+
+// Maps the values of a numeric, logical, date or timestamp column to unsigned
+// integers that sort in the same order, with NA and NaN last
+inline uint64_t GetSortKey(int x)
+{
+	return (x == NA_INTEGER)?((uint64_t)1 << 32):(uint64_t)((int64_t)x + 2147483648LL);
+}
+
+inline uint64_t GetSortKey(double x)
+{
+	if (ISNAN(x))
+		return ~(uint64_t)0;
+	if (x == 0)
+		x = 0; // -0 and 0 are the same
+
+	uint64_t bits;
+	memcpy(&bits, &x, sizeof(uint64_t));
+	return (bits & ((uint64_t)1 << 63))?(~bits):(bits | ((uint64_t)1 << 63));
+}
+
+inline uint64_t GetSortKey(const int *pInt, const double *pDouble, size_t row)
+{
+	return (pInt)?GetSortKey(pInt[row]):GetSortKey(pDouble[row]);
+}
+
+// The bits in which not all keys are the same
+uint64_t GetDifferentBits(const vector<uint64_t> &keys, int numThreads)
+{
+	const size_t n = keys.size();
+	const size_t part = (n + numThreads - 1)/numThreads;
+	vector<uint64_t> orBits(numThreads, 0), andBits(numThreads, ~(uint64_t)0);
+
+	RunInThreads(numThreads, [&](int t)
+	{
+		const size_t end = std::min(n, (t+1)*part);
+		for (size_t i = t*part ; i < end ; i++)
+		{
+			orBits[t] |= keys[i];
+			andBits[t] &= keys[i];
+		}
+	});
+
+	uint64_t allOr = 0, allAnd = ~(uint64_t)0;
+	for (int t = 0 ; t < numThreads ; t++)
+	{
+		allOr |= orBits[t];
+		allAnd &= andBits[t];
+	}
+	return allOr ^ allAnd;
+}
+
+// Stable LSD radix sort of the keys, moving the row numbers along. Each pass
+// handles eight bits, starting at firstShift, and bits in which all keys are
+// the same are skipped.
+void RadixSortRows(vector<uint64_t> &keys, vector<int> &rows, int numThreads, uint64_t differentBits, int firstShift)
+{
+	const size_t n = keys.size();
+	const size_t part = (n + numThreads - 1)/numThreads;
+
+	vector<uint64_t> keys2(n);
+	vector<int> rows2(n);
+	vector<vector<size_t> > offsets(numThreads, vector<size_t>(256));
+
+	for (int shift = firstShift ; shift < 64 ; shift += 8)
+	{
+		if (((differentBits >> shift) & 0xFF) == 0)
+			continue;
+
+		// The counts of each thread's part give the positions its keys move to
+		RunInThreads(numThreads, [&](int t)
+		{
+			vector<size_t> &counts = offsets[t];
+			std::fill(counts.begin(), counts.end(), 0);
+
+			const size_t end = std::min(n, (t+1)*part);
+			for (size_t i = t*part ; i < end ; i++)
+				counts[(keys[i] >> shift) & 0xFF]++;
+		});
+
+		size_t pos = 0;
+		for (int d = 0 ; d < 256 ; d++)
+		{
+			for (int t = 0 ; t < numThreads ; t++)
+			{
+				const size_t num = offsets[t][d];
+				offsets[t][d] = pos;
+				pos += num;
+			}
+		}
+
+		RunInThreads(numThreads, [&](int t)
+		{
+			vector<size_t> &dest = offsets[t];
+			const size_t end = std::min(n, (t+1)*part);
+			for (size_t i = t*part ; i < end ; i++)
+			{
+				const size_t p = dest[(keys[i] >> shift) & 0xFF]++;
+				keys2[p] = keys[i];
+				rows2[p] = rows[i];
+			}
+		});
+
+		keys.swap(keys2);
+		rows.swap(rows2);
+	}
+}
+
+// The first radix sort pass over the last key, using the digit counts that
+// were gathered per chunk while parsing. The keys are taken from the column
+// and scattered into their place right away, so that no separate passes are
+// needed to get the keys, to find the bits that differ or to count the digits.
+// Returns false if all keys are the same, in which case nothing is done.
+bool FirstSortPass(SEXP column, const vector<SortKeyCounts> &chunkCounts, const vector<size_t> &chunkStart,
+		   int numThreads, vector<uint64_t> &keys, vector<int> &rows, uint64_t &differentBits, int &shift)
+{
+	const size_t numChunks = chunkCounts.size();
+	uint64_t allOr = 0, allAnd = ~(uint64_t)0;
+	for (size_t c = 0 ; c < numChunks ; c++)
+	{
+		allOr |= chunkCounts[c].orBits;
+		allAnd &= chunkCounts[c].andBits;
+	}
+	differentBits = allOr ^ allAnd;
+	if (differentBits == 0)
+		return false;
+
+	shift = 0;
+	while (((differentBits >> shift) & 0xFF) == 0)
+		shift += 8;
+
+	// Within a digit, the chunks follow each other in the order of the file
+	const int b = shift/8;
+	vector<vector<size_t> > offsets(numChunks, vector<size_t>(256));
+	vector<size_t> chunkRows(numChunks, 0);
+	size_t pos = 0;
+	for (int d = 0 ; d < 256 ; d++)
+	{
+		for (size_t c = 0 ; c < numChunks ; c++)
+		{
+			offsets[c][d] = pos;
+			if (chunkCounts[c].counts.size() > 0)
+			{
+				const size_t num = chunkCounts[c].counts[b*256 + d];
+				chunkRows[c] += num;
+				pos += num;
+			}
+		}
+	}
+
+	if (pos != keys.size())
+		Throw("Internal error: the sort key was counted for %.0f rows instead of %.0f", (double)pos, (double)keys.size());
+
+	const int *pInt = (TYPEOF(column) == REALSXP)?0:(const int *)ValueVector::getDataPointer(column);
+	const double *pDouble = (TYPEOF(column) == REALSXP)?REAL(column):0;
+
+	RunInThreads(numThreads, [&](int t)
+	{
+		for (size_t c = t ; c < numChunks ; c += numThreads)
+		{
+			vector<size_t> &dest = offsets[c];
+			const size_t end = chunkStart[c] + chunkRows[c];
+			for (size_t i = chunkStart[c] ; i < end ; i++)
+			{
+				const uint64_t key = GetSortKey(pInt, pDouble, i);
+				const size_t p = dest[(key >> shift) & 0xFF]++;
+				keys[p] = key;
+				rows[p] = (int)i;
+			}
+		}
+	});
+	return true;
+}
+
+// Returns the rows in the order of the key columns, the first one being the
+// most significant. Rows with equal keys keep the order of the file. If the
+// digit counts of the last key are given, one per chunk of rows starting at
+// chunkStart, its first pass uses those.
+vector<int> OrderRows(const vector<SEXP> &keyColumns, size_t numRows, int numThreads,
+		      const vector<SortKeyCounts> &lastKeyCounts, const vector<size_t> &chunkStart)
+{
+	if (numRows < 100000)
+		numThreads = 1;
+
+	const size_t part = (numRows + numThreads - 1)/numThreads;
+	vector<int> rows(numRows);
+	vector<uint64_t> keys(numRows);
+	size_t firstKey = keyColumns.size();
+
+	if (lastKeyCounts.size() > 0)
+	{
+		firstKey--;
+		uint64_t differentBits;
+		int shift;
+		if (FirstSortPass(keyColumns[firstKey], lastKeyCounts, chunkStart, numThreads, keys, rows, 
+				  differentBits, shift))
+			RadixSortRows(keys, rows, numThreads, differentBits, shift + 8);
+		else
+		{
+			for (size_t i = 0 ; i < numRows ; i++)
+				rows[i] = (int)i;
+		}
+	}
+	else
+	{
+		for (size_t i = 0 ; i < numRows ; i++)
+			rows[i] = (int)i;
+	}
+
+	// Sorting on the last key first and on the first key last gives the order
+	// of all keys, since every pass is stable
+	for (size_t k = firstKey ; k-- > 0 ; )
+	{
+		SEXP column = keyColumns[k];
+		const int *pInt = (TYPEOF(column) == REALSXP)?0:(const int *)ValueVector::getDataPointer(column);
+		const double *pDouble = (TYPEOF(column) == REALSXP)?REAL(column):0;
+
+		RunInThreads(numThreads, [&](int t)
+		{
+			const size_t end = std::min(numRows, (t+1)*part);
+			for (size_t i = t*part ; i < end ; i++)
+				keys[i] = GetSortKey(pInt, pDouble, rows[i]);
+		});
+
+		RadixSortRows(keys, rows, numThreads, GetDifferentBits(keys, numThreads), 0);
+	}
+	return rows;
+}
+
+// Puts the values of the column in the given order
+void PermuteColumn(SEXP column, const vector<int> &order, int numThreads)
+{
+	const size_t numRows = order.size();
+	if (numRows < 100000)
+		numThreads = 1;
+	const size_t part = (numRows + numThreads - 1)/numThreads;
+
+	if (TYPEOF(column) == STRSXP)
+	{
+		if (PermuteLazyStrings(column, order))
+			return;
+
+		vector<SEXP> values(numRows);
+		for (size_t i = 0 ; i < numRows ; i++)
+			values[i] = STRING_ELT(column, order[i]);
+		for (size_t i = 0 ; i < numRows ; i++)
+			SET_STRING_ELT(column, i, values[i]);
+		return;
+	}
+
+	if (TYPEOF(column) == REALSXP)
+	{
+		double *pData = REAL(column);
+		vector<double> values(numRows);
+		RunInThreads(numThreads, [&](int t)
+		{
+			const size_t end = std::min(numRows, (t+1)*part);
+			for (size_t i = t*part ; i < end ; i++)
+				values[i] = pData[order[i]];
+		});
+		std::copy(values.begin(), values.end(), pData);
+	}
+	else
+	{
+		int *pData = (int *)ValueVector::getDataPointer(column);
+		vector<int> values(numRows);
+		RunInThreads(numThreads, [&](int t)
+		{
+			const size_t end = std::min(numRows, (t+1)*part);
+			for (size_t i = t*part ; i < end ; i++)
+				values[i] = pData[order[i]];
+		});
+		std::copy(values.begin(), values.end(), pData);
+	}
+}
+
+// Parses the complete lines of a sample of the data in this thread, and returns
+// the number of bytes per second, or 0 if the sample is too small to tell
+double MeasureParseRate(const char *pSample, size_t sampleSize, const string &columnSpec, const ColumnOptions &options)
+{
+	vector<ValueVector> columns = CreateColumns(columnSpec, options);
+	ValueVector matrixColumn;
+	LineParser lineParser(GetParseTargets(columns, matrixColumn, false));
+	vector<char> buffer;
+
+	const char *pPos = pSample;
+	const char *pEnd = pSample + sampleSize;
+	const char *pNewLine;
+	int numLines = 0;
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while ((pNewLine = (const char *)memchr(pPos, '\n', pEnd - pPos)) != 0)
+	{
+		buffer.assign(pPos, pNewLine + 1);
+		buffer.push_back(0);
+
+		// Errors are reported by the actual read
+		int failedCol;
+		const char *pFailedField;
+		if (!lineParser.parse(&buffer[0], buffer.size() - 1, failedCol, pFailedField))
+			break;
+
+		numLines++;
+		pPos = pNewLine + 1;
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (numLines < 16 || seconds <= 0)
+		return 0;
+	return (pPos - pSample)/seconds;
+}
+
+// Returns how many of at most maxThreads threads are worth using for totalBytes
+// of data, starting from how fast one thread parses a sample of it. Each thread
+// costs some time to start and to merge its columns into the output, so with a
+// serial parse time S and an overhead o per thread, the total S/n + n*o is
+// lowest for n = sqrt(S/o). There are never more threads than cores, or than
+// chunks of data to give them. A result of 1 means the data is best read serially.
+int ChooseNumThreads(int maxThreads, size_t totalBytes, const char *pSample, size_t sampleSize,
+		     const string &columnSpec, const ColumnOptions &options)
+{
+	const int numCores = (int)std::thread::hardware_concurrency();
+	if (numCores > 0)
+		maxThreads = std::min(maxThreads, numCores);
+
+	const size_t numChunks = (totalBytes + 65535)/65536;
+	if ((size_t)maxThreads > numChunks)
+		maxThreads = (int)numChunks;
+	if (maxThreads <= 1)
+		return 1;
+
+	const double bytesPerSecond = MeasureParseRate(pSample, sampleSize, columnSpec, options);
+	if (bytesPerSecond <= 0)
+		return maxThreads;
+
+	const double serialSeconds = totalBytes/bytesPerSecond;
+	const double threadOverhead = 0.002 + 0.000002*columnSpec.length();
+	const int numThreads = (int)sqrt(serialSeconds/threadOverhead);
+
+	return std::max(1, std::min(maxThreads, numThreads));
+}
+
+void CheckReadSettings(int maxLineLength, int numThreads)
+{
+	if (numThreads < 1)
+		Throw("Number of threads must be at least one");
+
+	if (maxLineLength <= 0)
+		Throw("Maximum line length must be larger than 0 (is %d)", maxLineLength);
+}
+
+// [[Rcpp::export]]
+SEXP ReadCSVColumns(vector<string> fileNames, string columnSpec, int maxLineLength, bool hasHeaders, int numThreads,
+		    string dateFormat, string timeFormat, vector<string> trueValues, vector<string> falseValues,
+		    string outputType, string onError, int maxProblems, SEXP progress, bool pinThreads,
+		    bool computeStats, SEXP text, vector<string> selectNames, bool selectRegex, string selectTypes,
+		    bool lazyStrings, vector<string> sortKeys, bool sortRows, double maxMemory, vector<string> stringNA) 
+{
+	CheckReadSettings(maxLineLength, numThreads);
+
+#ifndef HAVE_ALTREP
+	lazyStrings = false; // The columns are simply materialized right away
+#endif // !HAVE_ALTREP
+
+	// Data that's already in memory is read instead of the files, it's
+	// treated as a single file with this name in messages
+	const char *pText = 0;
+	size_t textLength = 0;
+	if (text != R_NilValue)
+	{
+		pText = GetTextData(text, textLength);
+		fileNames = vector<string>(1, "<text>");
+	}
+
+	if (fileNames.size() == 0)
+		Throw("No input files were specified");
+
+	if (stringNA.size() > 1)
+		Throw("Only one text can be used for missing strings");
+
+	ColumnOptions options;
+	options.dateFormat = dateFormat;
+	options.timeFormat = timeFormat;
+	options.logicalTokens.setTokens(trueValues, falseValues);
+	if (stringNA.size() == 1)
+	{
+		options.hasStringNA = true;
+		options.stringNA = stringNA[0];
+	}
+
+	ColumnSelection selection;
+	selection.names = selectNames;
+	selection.useRegex = selectRegex;
+	selection.types = selectTypes;
+
+	return ReadColumns(fileNames, pText, textLength, (hasHeaders)?2:1, 0, columnSpec, selection, maxLineLength, hasHeaders,
+			   numThreads, options, outputType, onError, maxProblems, progress, pinThreads, computeStats,
+			   lazyStrings, sortKeys, sortRows, maxMemory);
+}
+
+// Reads the files, or the text if pText is set. When pColumnNames is set, the
+// column specification and names are already known, and the data starts right
+// away without a header.
+SEXP ReadColumns(const vector<string> &fileNames, const char *pText, size_t textLength, int firstLineNumber,
+		 const vector<string> *pColumnNames, string columnSpec, const ColumnSelection &selection,
+		 int maxLineLength, bool hasHeaders, 
+		 int numThreads, const ColumnOptions &options, const string &outputType, const string &onError, 
+		 int maxProblems, SEXP progress, bool pinThreads, bool computeStats, bool lazyStrings,
+		 const vector<string> &sortKeys, bool sortRows, double maxMemory)
+{
+	// The column specification and names are determined from the first file,
+	// all other files must have the same layout
+	const string &fileName = fileNames[0];
+	FILE *pFile = (pText)?0:OpenInputFile(fileName);
+
+	AutoCloseFile autoCloser(pFile);
+	vector<string> names;
+
+	if (pColumnNames)
+		names = *pColumnNames;
+	else if (pText)
+	{
+		MemoryLineSource source(pText, pText + textLength);
+		columnSpec = GetColumnSpecAndColumnNames(fileName, source, columnSpec, hasHeaders, options, names);
+	}
+	else
+		columnSpec = GetColumnSpecAndColumnNames(fileName, pFile, columnSpec, hasHeaders, options, names);
+
+	// Columns that aren't selected are ignored like the '.' columns, so they're
+	// skipped by the parser and never stored
+	if (!selection.empty())
+		columnSpec = SelectColumns(fileName, columnSpec, names, selection);
+	const size_t numCols = columnSpec.length();
+
+	if (numCols == 0)
+		Throw("No columns found in file '%s'", fileName.c_str());
+
+	size_t ignoreColumns = 0;
+	for (size_t i = 0 ; i < numCols ; i++)
+	{
+		if (columnSpec[i] == '.')
+			ignoreColumns++;
+	}
+
+	if (ignoreColumns == numCols)
+		Throw("All columns will be ignored by the given column specification");
+
+	// The sort keys are checked before reading, and stored as positions in the output.
+	// The digits of the last one, which is sorted on first, are counted while parsing.
+	vector<int> keyPositions;
+	int sortKeyCol = -1;
+	for (size_t k = 0 ; k < sortKeys.size() ; k++)
+	{
+		int pos = 0;
+		size_t i = 0;
+		for ( ; i < numCols ; i++)
+		{
+			if (columnSpec[i] == '.')
+				continue;
+			if (names[i] == sortKeys[k])
+				break;
+			pos++;
+		}
+
+		if (i == numCols)
+			Throw("The sort key '%s' is not one of the columns that are read", sortKeys[k].c_str());
+		if (strchr("ilrdt", columnSpec[i]) == 0)
+			Throw("The sort key '%s' has type '%c', only numeric, logical, date and timestamp columns can be sorted on",
+			      sortKeys[k].c_str(), columnSpec[i]);
+
+		keyPositions.push_back(pos);
+		sortKeyCol = (int)i;
+	}
+
+	if (keyPositions.size() > 0 && outputType == "matrix")
+		Throw("Sorting is not available for matrix output");
+
+	if (outputType != "list" && outputType != "data.frame" && outputType != "data.table" && outputType != "matrix")
+		Throw("Unknown output type '%s', should be 'list', 'data.frame', 'data.table' or 'matrix'", outputType.c_str());
+
+	if (onError != "stop" && onError != "na")
+		Throw("Unknown error mode '%s', should be 'stop' or 'na'", onError.c_str());
+
+	if (maxProblems < 0)
+		Throw("The maximum number of problems can't be negative (is %d)", maxProblems);
+
+	// In 'na' mode, fields that can't be interpreted are stored as NA and reported
+	// afterwards, so that one bad line doesn't waste the work on the rest of the file
+	const bool errorsAsNA = (onError == "na");
+	ProblemList problems(maxProblems);
+	size_t totalProblems = 0;
+
+	// The statistics of all threads end up here
+	vector<ColumnStats> columnStats((computeStats)?numCols:0);
+
+	// For a matrix, all fields are stored in one vector per thread instead of
+	// in one vector per column, which matters for files with very many columns
+	const bool asMatrix = (outputType == "matrix");
+	const ValueVector::VectorType matrixType = (asMatrix)?GetMatrixType(columnSpec):ValueVector::Ignore;
+
+	// Allocate the list once, growing it with push_back would copy it for every column
+	const int numOutCols = (int)(numCols - ignoreColumns);
+	List listOfVectors((asMatrix)?1:numOutCols);
+	CharacterVector nameVec(numOutCols);
+	size_t numRows = 0;
+	vector<SortKeyCounts> sortKeyCounts; // per chunk, if they were gathered
+	vector<size_t> sortKeyChunkStart;
+
+#ifdef _WIN32
+	if (numThreads != 1)
+	{
+		numThreads = 1;
+		Rcerr << "Parellel interpretation of numbers is not available on Win32 platform, reverting to single thread" << endl;
+	}
+	if (maxMemory > 0)
+	{
+		maxMemory = 0;
+		Rcerr << "A memory limit is not available on Win32 platform, ignoring it" << endl;
+	}
+#else
+	// More threads than the data can keep busy only slow things down, and small
+	// inputs are read faster by the serial reader, without mapping the files
+	if (numThreads > 1)
+	{
+		const char *pSample = pText;
+		size_t totalBytes = 0, sampleSize = 0;
+		vector<char> sample;
+
+		if (pText)
+		{
+			if (hasHeaders)
+				pSample = SkipFirstLine(pText, pText + textLength);
+			totalBytes = pText + textLength - pSample;
+			sampleSize = std::min(totalBytes, (size_t)131072);
+		}
+		else
+		{
+			totalBytes = GetRemainingBytes(pFile) + GetFileSizes(fileNames, 1, fileNames.size());
+
+			// The sample is read ahead, the file position is restored afterwards
+			const long pos = ftell(pFile);
+			sample.resize(131072);
+			sampleSize = fread(&sample[0], 1, sample.size(), pFile);
+			fseek(pFile, pos, SEEK_SET);
+			pSample = &sample[0];
+		}
+
+		const int requestedThreads = numThreads;
+		numThreads = ChooseNumThreads(numThreads, totalBytes, pSample, sampleSize, columnSpec, options);
+		if (numThreads == 1)
+			Rcout << "Reading serially, " << requestedThreads << " threads would not be faster for this amount of data" << endl;
+	}
+#endif // _WIN32
+
+	// The serial reader can't keep to a memory limit, since it only knows the
+	// number of rows at the end; the mapped files can be read in batches
+	if (numThreads == 1 && maxMemory <= 0)
+	{
+		vector<ValueVector> columns = CreateColumns(columnSpec, options);
+		vector<char> buffer(maxLineLength);
+		char *buff = &(buffer[0]);
+
+		ValueVector matrixColumn(matrixType);
+		LineParser lineParser(GetParseTargets(columns, matrixColumn, asMatrix), (errorsAsNA)?(&problems):0,
+		                      (computeStats)?(&columnStats[0]):0, &columns);
+		size_t numElements = 0;
+		double bytesDone = 0;
+		bool reserved = false;
+
+		for (size_t f = 0 ; f < fileNames.size() ; f++)
+		{
+			FILE *pCurFile = pFile;
+			FILE *pOtherFile = (f > 0)?OpenInputFile(fileNames[f]):0;
+			AutoCloseFile otherCloser(pOtherFile);
+
+			if (pOtherFile)
+			{
+				CheckFileHeader(fileNames[f], pOtherFile, columnSpec, hasHeaders, options, names, fileName);
+				pCurFile = pOtherFile;
+			}
+
+			int lineNumber = firstLineNumber;
+			size_t fileLines = 0, fileBytes = 0;
+			size_t lineLength;
+
+			const char *pTextEnd = pText + textLength;
+			SerialLineReader reader = (pText)?SerialLineReader((hasHeaders)?SkipFirstLine(pText, pTextEnd):pText, pTextEnd)
+			                                 :SerialLineReader(pCurFile);
+
+			while (reader.next(buff, maxLineLength, lineLength))
+			{
+				int failedCol;
+				const char *pFailedField;
+
+				if (!lineParser.parse(buff, lineLength, failedCol, pFailedField))
+				{
+					if (!pFailedField)
+						Throw("Not enough columns on line %d of '%s'", lineNumber, fileNames[f].c_str());
+
+					Throw("Unable to interpret '%s' (file '%s', line %d, col %d) as type '%c'",
+					      pFailedField, fileNames[f].c_str(), lineNumber, failedCol+1, columnSpec[failedCol]);
+				}
+
+				if (problems.hasUnassigned())
+					problems.assignLine(f, 0, lineNumber);
+
+				lineNumber++;
+				numElements++;
+				bytesDone += lineLength;
+				fileBytes += lineLength;
+				fileLines++;
+
+				// Once the average line length is known, the rest of this file and the
+				// files after it can be estimated and room for all of it reserved, with
+				// a small margin. This is done once, so that later files don't make the
+				// rows staged so far be copied again.
+				if (fileLines == 1024 && !reserved)
+				{
+					const double remainingBytes = (double)reader.getRemainingBytes() + GetFileSizes(fileNames, f+1, fileNames.size());
+					const size_t estRows = numElements + (size_t)(1.05*remainingBytes*fileLines/fileBytes);
+					reserved = true;
+					if (asMatrix)
+						matrixColumn.reserve(estRows*numOutCols);
+					else
+					{
+						for (size_t i = 0 ; i < columns.size() ; i++)
+							columns[i].reserve(estRows);
+					}
+				}
+
+				if ((numElements & 0xFFFF) == 0)
+				{
+					if (UserInterruptPending())
+						Throw("Reading was interrupted by the user");
+					if (!ReportProgress(progress, bytesDone))
+						Throw("The progress function failed");
+				}
+			}
+		}
+
+		numRows = numElements;
+		if (asMatrix)
+		{
+			listOfVectors[0] = matrixColumn.allocateMatrix(numRows, numOutCols);
+			matrixColumn.copyToMatrix(listOfVectors[0], numRows, 0, 0, numRows, numOutCols);
+			matrixColumn.release();
+		}
+
+		int listPos = 0;
+		for (size_t i = 0 ; i < columns.size() ; i++)
+		{
+			if (!columns[i].ignore())
+			{
+				nameVec[listPos] = names[i];
+				if (!asMatrix)
+				{
+					// Free each staged column right away, so that the memory use
+					// doesn't peak at twice the size of the data
+					if (lazyStrings && columnSpec[i] == 's')
+						listOfVectors[listPos] = CreateLazyStringColumn(vector<ValueVector *>(1, &columns[i]),
+								vector<int>(1, 0), vector<size_t>(1, 0), vector<size_t>(1, numRows), numRows);
+					else
+						columns[i].addColumnToList(listOfVectors, listPos);
+					columns[i].release();
+				}
+				listPos++;
+			}
+		}
+	}
+	else // Parallel version using mmap
+	{
+#ifndef _WIN32
+		// Map all files first, so that the total size is known when splitting them
+		// into chunks. Each file is closed again once it's mapped. Text that's
+		// already in memory is split into chunks directly.
+		MappedFiles mappedFiles;
+		vector<const char *> dataStart(fileNames.size()), dataEnd(fileNames.size());
+		size_t totalBytes = 0;
+
+		for (size_t f = 0 ; f < fileNames.size() ; f++)
+		{
+			FILE *pOtherFile = (f > 0)?OpenInputFile(fileNames[f]):0;
+			AutoCloseFile otherCloser(pOtherFile);
+
+			if (pOtherFile)
+				CheckFileHeader(fileNames[f], pOtherFile, columnSpec, hasHeaders, options, names, fileName);
+
+			size_t fileSize = textLength;
+			const char *pData = (pText)?pText:mappedFiles.map((pOtherFile)?pOtherFile:pFile, fileNames[f], 0, fileSize);
+			const char *pEnd = pData + fileSize;
+
+			if (hasHeaders)
+				pData = SkipFirstLine(pData, pEnd);
+
+			dataStart[f] = pData;
+			dataEnd[f] = pEnd;
+			totalBytes += pEnd - pData;
+		}
+
+		// With a memory limit, the output is allocated up front, from the number of
+		// lines, and the chunks are parsed in batches that are merged into it one
+		// after the other, so that only one batch at a time is staged
+		const bool inBatches = (maxMemory > 0);
+		size_t allocRows = 0;
+		double stagingBudget = 0, stagingPerByte = 0;
+
+		if (inBatches)
+		{
+			for (size_t f = 0 ; f < fileNames.size() ; f++)
+			{
+				const size_t length = dataEnd[f] - dataStart[f];
+				allocRows += CountNewLines(dataStart[f], length, numThreads);
+				if (length > 0 && dataEnd[f][-1] != '\n')
+					allocRows++;
+			}
+
+			// The strings themselves aren't known yet, only the pointers to them
+			size_t outputRowBytes = 0, stagingRowBytes = 0;
+			bool hasStrings = false;
+			for (size_t i = 0 ; i < numCols ; i++)
+			{
+				if (columnSpec[i] == '.')
+					continue;
+
+				size_t valueSize = (columnSpec[i] == 'i' || columnSpec[i] == 'l')?sizeof(int):sizeof(double);
+				if (asMatrix)
+					valueSize = (matrixType == ValueVector::Integer)?sizeof(int):sizeof(double);
+				if (columnSpec[i] == 's')
+				{
+					outputRowBytes += sizeof(SEXP);
+					stagingRowBytes += sizeof(int) + sizeof(size_t) + 3*sizeof(int) + CHARSXP_OVERHEAD + sizeof(SEXP);
+					hasStrings = true;
+				}
+				else
+				{
+					outputRowBytes += valueSize;
+					stagingRowBytes += valueSize;
+				}
+			}
+
+			// Until a batch has been parsed, the text of a string column is assumed
+			// to be all different, each value needing its own CHARSXP, which errs on
+			// the safe side
+			const double bytesPerRow = (allocRows > 0)?((double)totalBytes/allocRows):1.0;
+			if (hasStrings)
+				stagingRowBytes += (size_t)bytesPerRow;
+			stagingPerByte = stagingRowBytes/bytesPerRow;
+
+			const double outputBytes = (double)outputRowBytes*allocRows;
+			stagingBudget = maxMemory - outputBytes;
+			if (stagingBudget <= 0)
+				Throw("The %.0f data lines need about %.1f MB, which is more than the memory limit of %.1f MB",
+				      (double)allocRows, outputBytes/(1024*1024), maxMemory/(1024*1024));
+
+			if (lazyStrings)
+			{
+				lazyStrings = false;
+				Rcout << "Lazy string columns can't be combined with a memory limit, creating the strings right away" << endl;
+			}
+		}
+
+		// Several chunks per thread, so that the work stays balanced when some
+		// parts of the files take longer to parse. Batches get at least four
+		// chunks per thread.
+		size_t chunkSize = std::max(totalBytes/(numThreads*8), (size_t)65536);
+		if (inBatches)
+			chunkSize = std::max(std::min(chunkSize, (size_t)(stagingBudget/stagingPerByte/(numThreads*4))), (size_t)65536);
+		vector<Chunk> chunks;
+
+		for (size_t f = 0 ; f < fileNames.size() ; f++)
+			AddChunks(f, dataStart[f], dataEnd[f], firstLineNumber, chunkSize, chunks);
+
+		Rcout << "Using " << numThreads << " threads to parse fields" << endl;
+
+		ThreadPlacement threadPlacement(numThreads, pinThreads);
+		std::atomic<bool> interrupt(false);
+		// The line length can differ from file to file, so each one is sampled
+		size_t estimatedRows = 0;
+		for (size_t f = 0 ; f < fileNames.size() ; f++)
+			estimatedRows += EstimateRows(dataStart[f], dataEnd[f] - dataStart[f], dataEnd[f] - dataStart[f]);
+
+		// The digit counts take 8 kB per chunk, they're only gathered if that's not
+		// more than the sort keys themselves need. With a memory limit there are
+		// many small chunks, and the counting is left to the sort.
+		if (sortKeyCol >= 0 && !asMatrix && !inBatches && chunks.size()*1024 <= estimatedRows)
+			sortKeyCounts.resize(chunks.size());
+		else
+			sortKeyCol = -1;
+
+		// Where the rows of each chunk are staged, and where they end up in the output
+		vector<int> chunkThread(chunks.size());
+		vector<size_t> chunkFirstRow(chunks.size()), chunkRows(chunks.size()), chunkOutPos(chunks.size());
+		vector<size_t> chunkFirstLine(chunks.size());
+		vector<void *> columnData(numCols, 0); // NULL for ignored and string columns
+		vector<std::pair<size_t, int> > stringColumns; // column and list position
+		size_t totalEntries = 0;
+		double bytesBefore = 0;
+		int numBatches = 0;
+
+		for (size_t batchBegin = 0 ; batchBegin < chunks.size() ; numBatches++)
+		{
+			size_t batchEnd = batchBegin;
+			size_t batchBytes = 0;
+			do
+			{
+				batchBytes += chunks[batchEnd].pEnd - chunks[batchEnd].pStart;
+				batchEnd++;
+			} while (batchEnd < chunks.size() && (!inBatches || 
+				 (batchBytes + (chunks[batchEnd].pEnd - chunks[batchEnd].pStart))*stagingPerByte <= stagingBudget));
+
+			ChunkQueue chunkQueue(chunks, batchBegin, batchEnd, threadPlacement.getNumRanges());
+			ThreadCompletion threadCompletion;
+
+			// Each thread reserves room for its share of the estimated number of rows, with
+			// some margin since the chunks won't be divided exactly evenly
+			const size_t reserveRows = (size_t)(1.25*estimatedRows*((double)batchBytes/totalBytes)/numThreads);
+
+			vector<std::unique_ptr<ParserThread> > parserThreads(numThreads);
+			for (int i = 0 ; i < numThreads ; i++)
+				parserThreads[i].reset(new ParserThread(i, columnSpec, options, asMatrix, matrixType, chunkQueue, 
+				                                        threadPlacement, fileNames, maxLineLength, errorsAsNA,
+									maxProblems, reserveRows, computeStats, sortKeyCol, &sortKeyCounts,
+									interrupt, threadCompletion));
+
+			vector<std::thread> threads;
+			string waitError;
+
+			try
+			{
+				for (int i = 0 ; i < numThreads ; i++)
+				{
+					threadCompletion.threadStarting();
+					threads.push_back(std::thread(&ParserThread::run, parserThreads[i].get()));
+				}
+			}
+			catch (const std::exception &e)
+			{
+				threadCompletion.threadDone(); // The one that couldn't be started
+				interrupt = true;
+				waitError = getString("Unable to start a parser thread: %s", e.what());
+			}
+
+			// Wait until everyone's done, meanwhile passing on a user interrupt to the
+			// threads and reporting the progress
+			WaitForParserThreads(parserThreads, threadCompletion, interrupt, progress, bytesBefore, waitError);
+
+			for (size_t i = 0 ; i < threads.size() ; i++)
+				threads[i].join();
+
+			if (waitError.length() > 0)
+				Throw("%s", waitError.c_str());
+
+			// Check if an error was encountered
+			for (int i = 0 ; i < numThreads ; i++)
+			{
+				const string &errorString = parserThreads[i]->getErrorString();
+				if (errorString.length() > 0)
+					Throw("%s", errorString.c_str());
+			}
+
+			// The next batch is sized with what this one really needed. The CHARSXPs
+			// of its distinct strings stay in use by the result, so they're taken
+			// from the budget for all batches that follow.
+			if (inBatches)
+			{
+				size_t stagedBytes = 0, stringBytes = 0;
+				for (int t = 0 ; t < numThreads ; t++)
+				{
+					stagedBytes += parserThreads[t]->getMemoryUsage();
+					const vector<ValueVector> &threadColumns = parserThreads[t]->getColumns();
+					for (size_t i = 0 ; i < threadColumns.size() ; i++)
+					{
+						if (columnSpec[i] == 's' && !asMatrix)
+							stringBytes += threadColumns[i].getStringMemoryUsage();
+					}
+				}
+				stagingPerByte = (double)(stagedBytes + stringBytes)/batchBytes;
+				stagingBudget -= stringBytes;
+				if (stagingBudget <= 0 && batchEnd < chunks.size())
+					Throw("The strings in the data need more memory than the limit of %.1f MB allows",
+					      maxMemory/(1024*1024));
+			}
+
+			if (computeStats)
+			{
+				for (int t = 0 ; t < numThreads ; t++)
+				{
+					const vector<ColumnStats> &threadStats = parserThreads[t]->getColumnStats();
+					for (size_t i = 0 ; i < numCols ; i++)
+						columnStats[i].merge(threadStats[i]);
+				}
+			}
+
+			for (int t = 0 ; t < numThreads ; t++)
+			{
+				const vector<ChunkResult> &results = parserThreads[t]->getChunkResults();
+				for (size_t r = 0 ; r < results.size() ; r++)
+				{
+					const ChunkResult &result = results[r];
+					chunkThread[result.chunkIdx] = t;
+					chunkFirstRow[result.chunkIdx] = result.firstRow;
+					chunkRows[result.chunkIdx] = result.numRows;
+				}
+			}
+
+			// Line numbers of problems are relative to their chunk until all chunk sizes are known
+			if (errorsAsNA)
+			{
+				for (size_t c = batchBegin ; c < batchEnd ; c++)
+				{
+					const bool sameFile = (c > 0 && chunks[c].fileIdx == chunks[c-1].fileIdx);
+					chunkFirstLine[c] = (sameFile)?(chunkFirstLine[c-1] + chunkRows[c-1]):chunks[c].firstLineNumber;
+				}
+
+				for (int t = 0 ; t < numThreads ; t++)
+				{
+					ProblemList &threadProblems = parserThreads[t]->getProblems();
+					vector<Problem> &p = threadProblems.getProblems();
+
+					for (size_t i = 0 ; i < p.size() ; i++)
+						p[i].line += chunkFirstLine[p[i].chunkIdx];
+
+					problems.getProblems().insert(problems.getProblems().end(), p.begin(), p.end());
+					totalProblems += threadProblems.getTotal();
+				}
+			}
+
+			for (size_t c = batchBegin ; c < batchEnd ; c++)
+			{
+				chunkOutPos[c] = totalEntries;
+				totalEntries += chunkRows[c];
+			}
+
+			// Everything that's allocated by R is done first, so that no R error can
+			// occur while other threads are writing. The numeric data is then copied
+			// by threads on the same NUMA node as the thread that parsed it, while
+			// this thread fills in the string columns, which needs the R API.
+			if (batchBegin == 0)
+			{
+				if (!inBatches)
+					allocRows = totalEntries;
+
+				if (asMatrix)
+					listOfVectors[0] = parserThreads[0]->getMatrixColumn().allocateMatrix(allocRows, numOutCols);
+
+				int listPos = 0;
+				for (size_t i = 0 ; i < numCols ; i++)
+				{
+					if (columnSpec[i] == '.')
+						continue;
+
+					nameVec[listPos] = names[i];
+					if (!asMatrix)
+					{
+						if (columnSpec[i] == 's' && lazyStrings)
+						{
+							// Only the string indices are gathered, the CHARSXPs are created
+							// when the elements are used
+							vector<ValueVector *> threadColumns(numThreads);
+							for (int t = 0 ; t < numThreads ; t++)
+								threadColumns[t] = &(parserThreads[t]->getColumns()[i]);
+
+							listOfVectors[listPos] = CreateLazyStringColumn(threadColumns, chunkThread, chunkFirstRow, 
+													chunkRows, allocRows);
+						}
+						else
+						{
+							listOfVectors[listPos] = parserThreads[0]->getColumns()[i].allocateColumn(allocRows);
+							if (columnSpec[i] == 's')
+								stringColumns.push_back(std::make_pair(i, listPos));
+							else
+								columnData[i] = ValueVector::getDataPointer(listOfVectors[listPos]);
+						}
+					}
+					listPos++;
+				}
+			}
+
+			if (totalEntries > allocRows)
+				Throw("Internal error: found more data lines than the %.0f that were counted", (double)allocRows);
+
+			MergeInfo mergeInfo(chunkThread, chunkFirstRow, chunkRows, chunkOutPos);
+			mergeInfo.columnData = columnData;
+			mergeInfo.totalRows = allocRows;
+			if (asMatrix)
+			{
+				mergeInfo.pMatrixData = ValueVector::getDataPointer(listOfVectors[0]);
+				mergeInfo.numMatrixCols = numOutCols;
+			}
+
+			List distinctStrings(stringColumns.size());
+			for (size_t s = 0 ; s < stringColumns.size() ; s++)
+			{
+				List threadStrings(numThreads);
+				for (int t = 0 ; t < numThreads ; t++)
+					threadStrings[t] = parserThreads[t]->getColumns()[stringColumns[s].first].createDistinctStrings();
+				distinctStrings[s] = threadStrings;
+			}
+
+			vector<std::thread> mergeThreads;
+			try
+			{
+				for (int t = 0 ; t < numThreads ; t++)
+					mergeThreads.push_back(std::thread(&ParserThread::copyChunks, parserThreads[t].get(), std::cref(mergeInfo)));
+			}
+			catch (const std::exception &e)
+			{
+				// Do the remaining ones here
+				for (int t = mergeThreads.size() ; t < numThreads ; t++)
+					parserThreads[t]->copyChunks(mergeInfo);
+			}
+
+			for (size_t s = 0 ; s < stringColumns.size() ; s++)
+			{
+				const size_t i = stringColumns[s].first;
+				SEXP column = listOfVectors[stringColumns[s].second];
+				List threadStrings(distinctStrings[s]);
+
+				for (size_t c = batchBegin ; c < batchEnd ; c++)
+				{
+					const int t = chunkThread[c];
+					parserThreads[t]->getColumns()[i].copyToColumn(column, chunkOutPos[c], chunkFirstRow[c], chunkRows[c], 
+							                               threadStrings[t]);
+				}
+
+				for (int t = 0 ; t < numThreads ; t++)
+					parserThreads[t]->getColumns()[i].release();
+			}
+
+			for (size_t t = 0 ; t < mergeThreads.size() ; t++)
+				mergeThreads[t].join();
+
+			bytesBefore += batchBytes;
+			batchBegin = batchEnd;
+		}
+
+		if (totalEntries != allocRows)
+			Throw("Internal error: read %.0f data lines instead of the %.0f that were counted", (double)totalEntries, (double)allocRows);
+
+		Rcout << "Read " << totalEntries << " data lines";
+		if (numBatches > 1)
+			Rcout << " in " << numBatches << " batches";
+		Rcout << endl;
+
+		numRows = totalEntries;
+		if (sortKeyCounts.size() > 0)
+			sortKeyChunkStart = chunkOutPos;
+#endif // !_WIN32
+	}
+
+	if (errorsAsNA)
+	{
+		if (numThreads == 1 && maxMemory <= 0)
+			totalProblems = problems.getTotal();
+
+		if (totalProblems > 0)
+		{
+			List problemTable = CreateProblemTable(problems.getProblems(), maxProblems, totalProblems, 
+			                                       fileNames, columnSpec, names);
+			if (asMatrix)
+			{
+				RObject matrix(listOfVectors[0]);
+				matrix.attr("problems") = problemTable;
+			}
+			else
+				listOfVectors.attr("problems") = problemTable;
+		}
+	}
+
+	if (computeStats)
+	{
+		List statsTable = CreateStatsTable(columnStats, columnSpec, names);
+		if (asMatrix)
+		{
+			RObject matrix(listOfVectors[0]);
+			matrix.attr("column.stats") = statsTable;
+		}
+		else
+			listOfVectors.attr("column.stats") = statsTable;
+	}
+
+	if (asMatrix)
+	{
+		RObject matrix(listOfVectors[0]);
+		matrix.attr("dimnames") = List::create(R_NilValue, nameVec);
+		return matrix;
+	}
+
+	// The sort runs over the finished columns, so it can use all threads again
+	if (keyPositions.size() > 0)
+	{
+		vector<SEXP> keyColumns;
+		for (size_t k = 0 ; k < keyPositions.size() ; k++)
+			keyColumns.push_back(listOfVectors[keyPositions[k]]);
+
+		vector<int> order = OrderRows(keyColumns, numRows, numThreads, sortKeyCounts, sortKeyChunkStart);
+		if (sortRows)
+		{
+			for (int i = 0 ; i < numOutCols ; i++)
+				PermuteColumn(listOfVectors[i], order, numThreads);
+		}
+		else
+		{
+			IntegerVector orderVec(numRows);
+			for (size_t i = 0 ; i < numRows ; i++)
+				orderVec[i] = order[i] + 1;
+			listOfVectors.attr("order") = orderVec;
+		}
+	}
+
+	listOfVectors.attr("names") = nameVec;
+	SetOutputClass(listOfVectors, outputType, (int)numRows);
+	return listOfVectors;
+}
+
+// State of a file that is read bit by bit while it grows: everything before
+// 'offset' has been read, the next line in the file is 'nextLineNumber'
+struct CSVFollower
+{
+	string fileName, columnSpec;
+	vector<string> names;
+	ColumnOptions options;
+	size_t offset;
+	int nextLineNumber;
+};
+
+#ifdef _WIN32
+// Without mmap, the new part of the file is read into memory
+const char *ReadFilePart(FILE *pFile, const string &fileName, size_t offset, vector<char> &buffer, size_t &length)
+{
+	if (_fseeki64(pFile, 0, SEEK_END) != 0)
+		Throw("Couldn't seek to the end of the file '%s'", fileName.c_str());
+
+	__int64 fileSize = _ftelli64(pFile);
+	if (fileSize < 0)
+		Throw("Unable to determine the size of '%s'", fileName.c_str());
+
+	if (offset > (size_t)fileSize)
+		Throw("The file '%s' is smaller than before, it may have been truncated or replaced", fileName.c_str());
+
+	buffer.resize((size_t)fileSize - offset + 1);
+
+	if (_fseeki64(pFile, (__int64)offset, SEEK_SET) != 0)
+		Throw("Unable to read the new part of '%s'", fileName.c_str());
+
+	length = fread(&buffer[0], 1, buffer.size() - 1, pFile);
+	if (ferror(pFile))
+		Throw("Unable to read the new part of '%s'", fileName.c_str());
+
+	return &buffer[0];
+}
+#endif // _WIN32
+
+// [[Rcpp::export]]
+SEXP OpenCSVFollower(string fileName, string columnSpec, bool hasHeaders, string dateFormat, string timeFormat, 
+		     vector<string> trueValues, vector<string> falseValues)
+{
+	std::unique_ptr<CSVFollower> pFollower(new CSVFollower());
+	CSVFollower &follower = *pFollower;
+
+	follower.fileName = fileName;
+	follower.options.dateFormat = dateFormat;
+	follower.options.timeFormat = timeFormat;
+	follower.options.logicalTokens.setTokens(trueValues, falseValues);
+
+	FILE *pFile = OpenInputFile(fileName, true);
+	AutoCloseFile autoCloser(pFile);
+
+	// Afterwards, the file is positioned at the first line with data
+	follower.columnSpec = GetColumnSpecAndColumnNames(fileName, pFile, columnSpec, hasHeaders, follower.options, 
+							  follower.names);
+	long pos = ftell(pFile);
+	if (pos < 0)
+		Throw("Unable to determine the position in '%s'", fileName.c_str());
+
+	follower.offset = (size_t)pos;
+	follower.nextLineNumber = (hasHeaders)?2:1;
+
+	return XPtr<CSVFollower>(pFollower.release(), true);
+}
+
+// Reads the lines that were added to the file since the previous call. Only the
+// new part of the file is mapped, and a last line that isn't complete yet is
+// left for the next time.
+// [[Rcpp::export]]
+SEXP ReadCSVFollower(SEXP followerPtr, int maxLineLength, int numThreads, string outputType, string onError, 
+		     int maxProblems, bool pinThreads, bool computeStats)
+{
+	CheckReadSettings(maxLineLength, numThreads);
+
+	XPtr<CSVFollower> pFollower(followerPtr);
+	CSVFollower &follower = *pFollower;
+
+	FILE *pFile = OpenInputFile(follower.fileName, true);
+	AutoCloseFile autoCloser(pFile);
+	size_t length = 0;
+
+#ifndef _WIN32
+	MappedFiles mappedFiles;
+	const char *pData = mappedFiles.map(pFile, follower.fileName, follower.offset, length);
+#else
+	vector<char> buffer;
+	const char *pData = ReadFilePart(pFile, follower.fileName, follower.offset, buffer, length);
+#endif // !_WIN32
+
+	while (length > 0 && pData[length-1] != '\n')
+		length--;
+
+	int numLines = 0;
+	for (const char *pPos = pData ; (pPos = (const char *)memchr(pPos, '\n', pData + length - pPos)) != 0 ; pPos++)
+		numLines++;
+
+	SEXP result = ReadColumns(vector<string>(1, follower.fileName), pData, length, follower.nextLineNumber, 
+				  &follower.names, follower.columnSpec, ColumnSelection(), maxLineLength, false, numThreads, follower.options, 
+				  outputType, onError, maxProblems, R_NilValue, pinThreads, computeStats, false, 
+				  vector<string>(), false, 0);
+
+	// Only advance when everything went well, so that a failed read can be retried
+	follower.offset += length;
+	follower.nextLineNumber += numLines;
+	return result;
+}
+
+// Only the first line (and the second one when the types need to be guessed)
+// is read, none of the data is parsed
+// [[Rcpp::export]]
+SEXP ProbeCSVColumns(string fileName, string columnSpec, bool hasHeaders, string dateFormat, string timeFormat)
+{
+	ColumnOptions options;
+	options.dateFormat = dateFormat;
+	options.timeFormat = timeFormat;
+
+	FILE *pFile = OpenInputFile(fileName);
+	AutoCloseFile autoCloser(pFile);
+	FileLineSource source(pFile);
+	vector<string> names;
+
+	columnSpec = GetColumnSpecAndColumnNames(fileName, source, columnSpec, hasHeaders, options, names, false);
+
+	const int numCols = (int)columnSpec.length();
+	CharacterVector column(numCols), type(numCols);
+	for (int i = 0 ; i < numCols ; i++)
+	{
+		column[i] = names[i];
+		type[i] = string(1, columnSpec[i]);
+	}
+
+	List table(2);
+	table[0] = column;
+	table[1] = type;
+	table.attr("names") = CharacterVector::create("column", "type");
+	SetOutputClass(table, "data.frame", numCols);
+	table.attr("column.types") = columnSpec;
+	return table;
+}
+
+// Counts the newline characters in [pStart, pEnd) eight bytes at a time: a
+// byte of 'x' is zero where the data has a newline, and those bytes end up
+// with just their high bit set in 'found'. The per-byte counts are summed in
+// 'counts' and only added up every 255 words, before a byte could overflow.
+size_t CountNewLines(const char *pStart, const char *pEnd)
+{
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t low = 0x7F7F7F7F7F7F7F7FULL;
+	const uint64_t newLines = ones * '\n';
+	size_t count = 0;
+	const char *pPos = pStart;
+
+	while (pPos < pEnd && ((uintptr_t)pPos & 7) != 0)
+		count += (*pPos++ == '\n');
+
+	while (pEnd - pPos >= 8)
+	{
+		uint64_t counts = 0;
+		for (int i = 0 ; i < 255 && pEnd - pPos >= 8 ; i++, pPos += 8)
+		{
+			uint64_t word;
+			memcpy(&word, pPos, 8);
+
+			const uint64_t x = word ^ newLines;
+			const uint64_t found = ~(((x & low) + low) | x | low);
+			counts += found >> 7;
+		}
+
+		// Each byte is at most 255, so add them up in pairs first
+		const uint64_t pairs = (counts & 0x00FF00FF00FF00FFULL) + ((counts >> 8) & 0x00FF00FF00FF00FFULL);
+		count += (size_t)((pairs * 0x0001000100010001ULL) >> 48);
+	}
+
+	while (pPos < pEnd)
+		count += (*pPos++ == '\n');
+
+	return count;
+}
+
+#ifndef _WIN32
+// Each thread counts the newlines in its own part of the data
+size_t CountNewLines(const char *pData, size_t length, int numThreads)
+{
+	const size_t minPart = 1024*1024;
+	numThreads = (int)std::max((size_t)1, std::min((size_t)numThreads, length/minPart));
+	if (numThreads == 1)
+		return CountNewLines(pData, pData + length);
+
+	vector<size_t> counts(numThreads, 0);
+	vector<std::thread> threads;
+	const size_t partSize = length/numThreads;
+
+	for (int i = 0 ; i < numThreads ; i++)
+	{
+		const char *pStart = pData + i*partSize;
+		const char *pEnd = (i == numThreads-1)?(pData + length):(pStart + partSize);
+		threads.push_back(std::thread([pStart, pEnd, &counts, i]() { counts[i] = CountNewLines(pStart, pEnd); }));
+	}
+
+	size_t total = 0;
+	for (int i = 0 ; i < numThreads ; i++)
+	{
+		threads[i].join();
+		total += counts[i];
+	}
+	return total;
+}
+#endif // !_WIN32
+
+// Counts the lines with data in each file, without parsing them: a last line
+// without a newline is counted too, a header line isn't
+// [[Rcpp::export]]
+SEXP CountCSVRows(vector<string> fileNames, bool hasHeaders, int numThreads)
+{
+	if (numThreads < 1)
+		Throw("Number of threads must be at least one");
+
+	NumericVector rows(fileNames.size());
+	for (size_t f = 0 ; f < fileNames.size() ; f++)
+	{
+		FILE *pFile = OpenInputFile(fileNames[f]);
+		AutoCloseFile autoCloser(pFile);
+		size_t numLines = 0;
+		char lastChar = '\n';
+
+#ifndef _WIN32
+		MappedFiles mappedFiles;
+		size_t length = 0;
+		const char *pData = mappedFiles.map(pFile, fileNames[f], 0, length);
+
+		numLines = CountNewLines(pData, length, numThreads);
+		if (length > 0)
+			lastChar = pData[length-1];
+#else
+		vector<char> buffer(1024*1024);
+		size_t num;
+		while ((num = fread(&buffer[0], 1, buffer.size(), pFile)) > 0)
+		{
+			numLines += CountNewLines(&buffer[0], &buffer[0] + num);
+			lastChar = buffer[num-1];
+		}
+#endif // !_WIN32
+		if (lastChar != '\n')
+			numLines++;
+		if (hasHeaders && numLines > 0)
+			numLines--;
+
+		rows[f] = (double)numLines;
+	}
+	return rows;
+}
+
+// The output files of PartitionCSVFiles. The threads append their lines in
+// batches, and each file has a lock of its own.
+class PartitionFiles
+{
+public:
+	PartitionFiles(const vector<string> &fileNames);
+	~PartitionFiles();
+
+	int size() const							{ return (int)m_files.size(); }
+	double getRows(int p) const						{ return (double)m_rows[p]; }
+	bool write(int p, const char *pData, size_t length, size_t rows);
+	void close();
+private:
+	vector<string> m_fileNames;
+	vector<FILE *> m_files;
+	vector<size_t> m_rows;
+	std::unique_ptr<std::mutex[]> m_mutexes;
+};
+
+PartitionFiles::PartitionFiles(const vector<string> &fileNames) 
+	: m_fileNames(fileNames), m_files(fileNames.size(), (FILE *)0), m_rows(fileNames.size(), 0),
+	  m_mutexes(new std::mutex[fileNames.size()])
+{
+	for (size_t p = 0 ; p < fileNames.size() ; p++)
+	{
+		m_files[p] = fopen(fileNames[p].c_str(), "wb");
+		if (!m_files[p])
+		{
+			// The destructor won't run, the files that were created are still
+			// empty and are removed again
+			for (size_t q = 0 ; q < p ; q++)
+			{
+				fclose(m_files[q]);
+				remove(fileNames[q].c_str());
+			}
+			Throw("Unable to create the output file '%s'", fileNames[p].c_str());
+		}
+	}
+}
+
+PartitionFiles::~PartitionFiles()
+{
+	for (size_t p = 0 ; p < m_files.size() ; p++)
+	{
+		if (m_files[p])
+			fclose(m_files[p]);
+	}
+}
+
+bool PartitionFiles::write(int p, const char *pData, size_t length, size_t rows)
+{
+	std::lock_guard<std::mutex> lock(m_mutexes[p]);
+	m_rows[p] += rows;
+	return fwrite(pData, 1, length, m_files[p]) == length;
+}
+
+void PartitionFiles::close()
+{
+	for (size_t p = 0 ; p < m_files.size() ; p++)
+	{
+		FILE *pFile = m_files[p];
+		m_files[p] = 0;
+		if (fclose(pFile) != 0)
+			Throw("Unable to write to the output file '%s'", m_fileNames[p].c_str());
+	}
+}
+
+// Collects the lines of one thread per partition, so that a partition file is
+// only locked and written to once a larger batch of lines is available
+class PartitionBuffers
+{
+public:
+	PartitionBuffers(PartitionFiles &files, int keyCol) 
+		: m_files(files), m_keyCol(keyCol), m_buffers(files.size()), m_rows(files.size(), 0) { }
+
+	// pLine doesn't include the newline. Returns false if the line doesn't have
+	// enough columns, or if the lines couldn't be written.
+	bool add(const char *pLine, const char *pEnd, bool &writeError);
+	bool flush();
+private:
+	bool flush(int p);
+
+	PartitionFiles &m_files;
+	const int m_keyCol;
+	vector<string> m_buffers;
+	vector<size_t> m_rows;
+};
+
+// A key that's entirely a (finite) number, in which case value is set to it,
+// with -0 becoming 0
+inline bool parseNumericKey(const char *pField, const char *pFieldEnd, double &value)
+{
+	char buf[64];
+	const size_t len = pFieldEnd - pField;
+	if (len == 0 || len >= sizeof(buf))
+		return false;
+
+	memcpy(buf, pField, len);
+	buf[len] = '\0';
+
+	char *endptr;
+	value = strtod(buf, &endptr);
+	if (endptr != buf + len || !std::isfinite(value))
+		return false;
+
+	if (value == 0)
+		value = 0;
+	return true;
+}
+
+inline bool PartitionBuffers::add(const char *pLine, const char *pEnd, bool &writeError)
+{
+	writeError = false;
+
+	const char *pField = pLine;
+	for (int c = 0 ; c < m_keyCol ; c++)
+	{
+		pField = (const char *)memchr(pField, ',', pEnd - pField);
+		if (!pField)
+			return false;
+		pField++;
+	}
+
+	const char *pFieldEnd = (const char *)memchr(pField, ',', pEnd - pField);
+	if (!pFieldEnd)
+		pFieldEnd = pEnd;
+
+	// The same value has to end up in the same partition, with or without
+	// surrounding whitespace or a CR at the end of the line
+	while (pField < pFieldEnd && (*pField == ' ' || *pField == '\t'))
+		pField++;
+	while (pFieldEnd > pField && (pFieldEnd[-1] == ' ' || pFieldEnd[-1] == '\t' || pFieldEnd[-1] == '\r'))
+		pFieldEnd--;
+
+	// Numeric keys are hashed by value, so that e.g. 1, 1.0 and 1e0 end up in
+	// the same partition; everything else is hashed as text using FNV-1a. This
+	// is followed by a mix so that all bits affect the partition.
+	uint64_t h = 14695981039346656037ULL;
+	double number;
+	if (parseNumericKey(pField, pFieldEnd, number))
+		memcpy(&h, &number, sizeof(double));
+	else
+	{
+		for (const char *pPos = pField ; pPos < pFieldEnd ; pPos++)
+		{
+			h ^= (unsigned char)*pPos;
+			h *= 1099511628211ULL;
+		}
+	}
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+
+	const int p = (int)(h % (uint64_t)m_buffers.size());
+	string &buffer = m_buffers[p];
+	buffer.append(pLine, pEnd - pLine);
+	buffer += '\n';
+	m_rows[p]++;
+
+	if (buffer.length() >= 1024*1024 && !flush(p))
+	{
+		writeError = true;
+		return false;
+	}
+	return true;
+}
+
+bool PartitionBuffers::flush(int p)
+{
+	string &buffer = m_buffers[p];
+	const bool ok = m_files.write(p, buffer.data(), buffer.length(), m_rows[p]);
+	buffer.clear();
+	m_rows[p] = 0;
+	return ok;
+}
+
+bool PartitionBuffers::flush()
+{
+	for (int p = 0 ; p < m_files.size() ; p++)
+	{
+		if (m_buffers[p].length() > 0 && !flush(p))
+			return false;
+	}
+	return true;
+}
+
+#ifndef _WIN32
+// Takes chunks of lines from the input files and distributes their lines over
+// the partitions, until all chunks are done or an error occurs
+class PartitionThread
+{
+public:
+	PartitionThread(const vector<Chunk> &chunks, std::atomic<size_t> &nextChunk, PartitionFiles &files, int keyCol,
+			const vector<string> &fileNames, std::atomic<bool> &interrupt, ThreadCompletion &completion)
+		: m_chunks(chunks), m_nextChunk(nextChunk), m_buffers(files, keyCol), m_fileNames(fileNames),
+		  m_interrupt(interrupt), m_completion(completion) { }
+
+	void run();
+	const string &getErrorString() const					{ return m_errorString; }
+private:
+	void partitionChunk(const Chunk &chunk);
+
+	const vector<Chunk> &m_chunks;
+	std::atomic<size_t> &m_nextChunk;
+	PartitionBuffers m_buffers;
+	const vector<string> &m_fileNames;
+	std::atomic<bool> &m_interrupt;
+	ThreadCompletion &m_completion;
+	string m_errorString;
+};
+
+void PartitionThread::run()
+{
+	size_t c;
+	while (m_errorString.length() == 0 && !m_interrupt && (c = m_nextChunk++) < m_chunks.size())
+		partitionChunk(m_chunks[c]);
+
+	if (m_errorString.length() == 0 && !m_buffers.flush())
+		m_errorString = "Unable to write to one of the output files";
+
+	if (m_errorString.length() > 0)
+		m_interrupt = true;
+
+	m_completion.threadDone();
+}
+
+void PartitionThread::partitionChunk(const Chunk &chunk)
+{
+	const char *pLine = chunk.pStart;
+	while (pLine < chunk.pEnd)
+	{
+		const char *pNewLine = (const char *)memchr(pLine, '\n', chunk.pEnd - pLine);
+		const char *pLineEnd = (pNewLine)?pNewLine:chunk.pEnd;
+		bool writeError;
+
+		if (!m_buffers.add(pLine, pLineEnd, writeError))
+		{
+			if (writeError)
+				m_errorString = "Unable to write to one of the output files";
+			else
+				m_errorString = getString("Not enough columns on line %d of '%s'", chunk.lineNumber(pLine), 
+							  m_fileNames[chunk.fileIdx].c_str());
+			return;
+		}
+		pLine = pLineEnd + 1;
+	}
+}
+#endif // !_WIN32
+
+// Splits the data lines of the files over the output files, by a hash of the
+// text in column keyCol. The lines are copied as they are, so that each output
+// file can be read with the same column specification as the input.
+// [[Rcpp::export]]
+SEXP PartitionCSVFiles(vector<string> fileNames, string keyName, int keyCol, vector<string> outputNames, 
+		       bool hasHeaders, int numThreads, int maxLineLength)
+{
+	CheckReadSettings(maxLineLength, numThreads);
+
+	if (fileNames.size() == 0)
+		Throw("No input files were specified");
+	if (outputNames.size() == 0)
+		Throw("The number of partitions must be at least one");
+
+	string header;
+	if (hasHeaders)
+	{
+		FILE *pFile = OpenInputFile(fileNames[0]);
+		AutoCloseFile autoCloser(pFile);
+
+		if (!ReadInputLine(pFile, header))
+			Throw("Unable to read first line from file '%s'", fileNames[0].c_str());
+
+		if (keyName.length() > 0)
+		{
+			vector<string> names;
+			SplitLine(header, names, ",", "\"'", "", false);
+
+			keyCol = (int)(std::find(names.begin(), names.end(), keyName) - names.begin());
+			if (keyCol == (int)names.size())
+				Throw("There is no column named '%s' in '%s'", keyName.c_str(), fileNames[0].c_str());
+		}
+	}
+
+	if (keyCol < 0)
+		Throw("The key column should be a column name or a positive column number");
+
+	PartitionFiles outputFiles(outputNames);
+	if (hasHeaders)
+	{
+		const string headerLine = header + "\n";
+		for (int p = 0 ; p < outputFiles.size() ; p++)
+		{
+			if (!outputFiles.write(p, headerLine.data(), headerLine.length(), 0))
+				Throw("Unable to write to the output file '%s'", outputNames[p].c_str());
+		}
+	}
+
+#ifndef _WIN32
+	MappedFiles mappedFiles;
+	vector<Chunk> chunks;
+	size_t totalBytes = 0;
+	vector<const char *> dataStart(fileNames.size()), dataEnd(fileNames.size());
+
+	for (size_t f = 0 ; f < fileNames.size() ; f++)
+	{
+		FILE *pFile = OpenInputFile(fileNames[f]);
+		AutoCloseFile autoCloser(pFile);
+
+		string fileHeader;
+		if (hasHeaders && f > 0 && (!ReadInputLine(pFile, fileHeader) || fileHeader != header))
+			Throw("The column names in '%s' differ from the ones in '%s'", fileNames[f].c_str(), fileNames[0].c_str());
+
+		size_t length = 0;
+		const char *pData = mappedFiles.map(pFile, fileNames[f], 0, length);
+		dataEnd[f] = pData + length;
+		dataStart[f] = (hasHeaders)?SkipFirstLine(pData, dataEnd[f]):pData;
+		totalBytes += dataEnd[f] - dataStart[f];
+	}
+
+	const size_t chunkSize = std::max(totalBytes/(numThreads*8), (size_t)65536);
+	for (size_t f = 0 ; f < fileNames.size() ; f++)
+		AddChunks(f, dataStart[f], dataEnd[f], (hasHeaders)?2:1, chunkSize, chunks);
+
+	std::atomic<size_t> nextChunk(0);
+	std::atomic<bool> interrupt(false);
+	ThreadCompletion threadCompletion;
+	vector<std::unique_ptr<PartitionThread> > partitionThreads;
+	vector<std::thread> threads;
+	string waitError;
+
+	try
+	{
+		for (int i = 0 ; i < numThreads ; i++)
+		{
+			partitionThreads.push_back(std::unique_ptr<PartitionThread>(new PartitionThread(chunks, nextChunk, 
+						   outputFiles, keyCol, fileNames, interrupt, threadCompletion)));
+			threadCompletion.threadStarting();
+			threads.push_back(std::thread(&PartitionThread::run, partitionThreads.back().get()));
+		}
+	}
+	catch (const std::exception &e)
+	{
+		threadCompletion.threadDone();
+		interrupt = true;
+		waitError = getString("Unable to start a thread: %s", e.what());
+	}
+
+	while (!threadCompletion.waitFor(100))
+	{
+		if (waitError.length() == 0 && UserInterruptPending())
+		{
+			waitError = "Partitioning was interrupted by the user";
+			interrupt = true;
+		}
+	}
+
+	for (size_t i = 0 ; i < threads.size() ; i++)
+		threads[i].join();
+
+	if (waitError.length() > 0)
+		Throw("%s", waitError.c_str());
+
+	for (size_t i = 0 ; i < partitionThreads.size() ; i++)
+	{
+		const string &errorString = partitionThreads[i]->getErrorString();
+		if (errorString.length() > 0)
+			Throw("%s", errorString.c_str());
+	}
+#else
+	// Line by line, in a single thread
+	PartitionBuffers buffers(outputFiles, keyCol);
+	vector<char> buffer(maxLineLength);
+
+	for (size_t f = 0 ; f < fileNames.size() ; f++)
+	{
+		FILE *pFile = OpenInputFile(fileNames[f]);
+		AutoCloseFile autoCloser(pFile);
+
+		string fileHeader;
+		if (hasHeaders && (!ReadInputLine(pFile, fileHeader) || fileHeader != header))
+			Throw("The column names in '%s' differ from the ones in '%s'", fileNames[f].c_str(), fileNames[0].c_str());
+
+		SerialLineReader reader(pFile);
+		int lineNumber = (hasHeaders)?2:1;
+		size_t lineLength;
+
+		while (reader.next(&buffer[0], maxLineLength, lineLength))
+		{
+			if (lineLength > 0 && buffer[lineLength-1] == '\n')
+				lineLength--;
+
+			bool writeError;
+			if (!buffers.add(&buffer[0], &buffer[0] + lineLength, writeError))
+			{
+				if (writeError)
+					Throw("Unable to write to one of the output files");
+				Throw("Not enough columns on line %d of '%s'", lineNumber, fileNames[f].c_str());
+			}
+
+			if ((lineNumber++ & 0xFFFF) == 0 && UserInterruptPending())
+				Throw("Partitioning was interrupted by the user");
+		}
+	}
+
+	if (!buffers.flush())
+		Throw("Unable to write to one of the output files");
+#endif // !_WIN32
+
+	outputFiles.close();
+
+	NumericVector rows(outputFiles.size());
+	for (int p = 0 ; p < outputFiles.size() ; p++)
+		rows[p] = outputFiles.getRows(p);
+	return rows;
+}
+
+// An aggregate of aggregate.csv.columns: its function, and the column it's
+// computed on (-1 for count())
+struct Aggregate
+{
+	enum Function { Count, Sum, Mean, Min, Max };
+
+	Function function;
+	int column;
+};
+
+// The groups found by one thread, with the state of each aggregate. A group
+// is identified by the binary values of its key columns, one after the
+// other, and each aggregate takes two numbers per group: a count of the
+// values that aren't NA, and their sum, minimum or maximum.
+class GroupTable
+{
+public:
+	GroupTable(const vector<ValueVector> &columns, const vector<int> &keyColumns, const vector<Aggregate> &aggregates)
+		: m_columns(columns), m_keyColumns(keyColumns), m_aggregates(aggregates) { }
+
+	// Adds the values that were parsed last; 'position' tells where the line is
+	// in the input, so that the groups can be reported in order of appearance
+	void addLastRow(uint64_t position);
+	void merge(const GroupTable &other);
+	List createTable(const vector<string> &keyNames, const vector<string> &aggregateNames) const;
+private:
+	int getGroup(const string &key, uint64_t position);
+	void updateAggregates(int group, int a, double value);
+
+	const vector<ValueVector> &m_columns;
+	const vector<int> &m_keyColumns;
+	const vector<Aggregate> &m_aggregates;
+
+	std::unordered_map<string, int> m_groupIndex;
+	vector<string> m_groupKeys;
+	vector<uint64_t> m_firstPosition;
+	vector<double> m_state; // per group, two numbers per aggregate
+	string m_key;
+};
+
+inline int GroupTable::getGroup(const string &key, uint64_t position)
+{
+	std::unordered_map<string, int>::const_iterator it = m_groupIndex.find(key);
+	if (it != m_groupIndex.end())
+		return it->second;
+
+	const int group = (int)m_groupKeys.size();
+	m_groupIndex[key] = group;
+	m_groupKeys.push_back(key);
+	m_firstPosition.push_back(position);
+
+	for (size_t a = 0 ; a < m_aggregates.size() ; a++)
+	{
+		const Aggregate::Function f = m_aggregates[a].function;
+		m_state.push_back(0);
+		m_state.push_back((f == Aggregate::Min)?R_PosInf:((f == Aggregate::Max)?R_NegInf:0));
+	}
+	return group;
+}
+
+inline void GroupTable::updateAggregates(int group, int a, double value)
+{
+	double *pState = &m_state[(group*m_aggregates.size() + a)*2];
+	pState[0]++;
+
+	switch(m_aggregates[a].function)
+	{
+	case Aggregate::Count:
+		break;
+	case Aggregate::Sum:
+	case Aggregate::Mean:
+		pState[1] += value;
+		break;
+	case Aggregate::Min:
+		pState[1] = std::min(pState[1], value);
+		break;
+	case Aggregate::Max:
+		pState[1] = std::max(pState[1], value);
+		break;
+	}
+}
+
+inline void GroupTable::addLastRow(uint64_t position)
+{
+	m_key.clear();
+	for (size_t k = 0 ; k < m_keyColumns.size() ; k++)
+	{
+		const ValueVector &column = m_columns[m_keyColumns[k]];
+		switch(column.getType())
+		{
+		case ValueVector::Integer:
+		case ValueVector::Logical:
+			{
+				const int value = column.lastValue<int>();
+				m_key.append((const char *)&value, sizeof(int));
+			}
+			break;
+		case ValueVector::String:
+			{
+				const char *pStr = "";
+				int length = -1;
+				column.lastString(pStr, length);
+				m_key.append((const char *)&length, sizeof(int));
+				if (length > 0)
+					m_key.append(pStr, length);
+			}
+			break;
+		default:
+			{
+				double value = column.lastValue<double>();
+				if (ISNAN(value))
+					value = NA_REAL;
+				else if (value == 0)
+					value = 0; // -0 and 0 are the same group
+				m_key.append((const char *)&value, sizeof(double));
+			}
+		}
+	}
+
+	const int group = getGroup(m_key, position);
+
+	for (size_t a = 0 ; a < m_aggregates.size() ; a++)
+	{
+		const int col = m_aggregates[a].column;
+		if (col < 0)
+		{
+			updateAggregates(group, a, 0);
+			continue;
+		}
+
+		const ValueVector &column = m_columns[col];
+		if (column.getType() == ValueVector::Integer || column.getType() == ValueVector::Logical)
+		{
+			const int value = column.lastValue<int>();
+			if (value != NA_INTEGER)
+				updateAggregates(group, a, value);
+		}
+		else
+		{
+			const double value = column.lastValue<double>();
+			if (!ISNAN(value))
+				updateAggregates(group, a, value);
+		}
+	}
+}
+
+void GroupTable::merge(const GroupTable &other)
+{
+	const size_t numAggregates = m_aggregates.size();
+	for (size_t g = 0 ; g < other.m_groupKeys.size() ; g++)
+	{
+		const int group = getGroup(other.m_groupKeys[g], other.m_firstPosition[g]);
+		m_firstPosition[group] = std::min(m_firstPosition[group], other.m_firstPosition[g]);
+
+		for (size_t a = 0 ; a < numAggregates ; a++)
+		{
+			double *pState = &m_state[(group*numAggregates + a)*2];
+			const double *pOther = &other.m_state[(g*numAggregates + a)*2];
+
+			pState[0] += pOther[0];
+			if (m_aggregates[a].function == Aggregate::Min)
+				pState[1] = std::min(pState[1], pOther[1]);
+			else if (m_aggregates[a].function == Aggregate::Max)
+				pState[1] = std::max(pState[1], pOther[1]);
+			else
+				pState[1] += pOther[1];
+		}
+	}
+}
+
+bool CompareFirstPosition(const std::pair<uint64_t, int> &a, const std::pair<uint64_t, int> &b)
+{
+	return a.first < b.first;
+}
+
+// One row per group, in the order in which the groups first appear in the input
+List GroupTable::createTable(const vector<string> &keyNames, const vector<string> &aggregateNames) const
+{
+	const int numGroups = (int)m_groupKeys.size();
+	const size_t numKeys = m_keyColumns.size();
+	const size_t numAggregates = m_aggregates.size();
+
+	vector<std::pair<uint64_t, int> > order(numGroups);
+	for (int g = 0 ; g < numGroups ; g++)
+		order[g] = std::make_pair(m_firstPosition[g], g);
+	std::sort(order.begin(), order.end(), CompareFirstPosition);
+
+	List table(numKeys + numAggregates);
+	CharacterVector names(numKeys + numAggregates);
+
+	for (size_t k = 0 ; k < numKeys ; k++)
+	{
+		table[k] = m_columns[m_keyColumns[k]].allocateColumn(numGroups);
+		names[k] = keyNames[k];
+	}
+
+	for (int r = 0 ; r < numGroups ; r++)
+	{
+		const char *pKey = m_groupKeys[order[r].second].data();
+		for (size_t k = 0 ; k < numKeys ; k++)
+		{
+			SEXP column = table[k];
+			switch(m_columns[m_keyColumns[k]].getType())
+			{
+			case ValueVector::Integer:
+			case ValueVector::Logical:
+				memcpy((int *)ValueVector::getDataPointer(column) + r, pKey, sizeof(int));
+				pKey += sizeof(int);
+				break;
+			case ValueVector::String:
+				{
+					int length;
+					memcpy(&length, pKey, sizeof(int));
+					pKey += sizeof(int);
+					if (length < 0)
+						SET_STRING_ELT(column, r, NA_STRING);
+					else
+					{
+						SET_STRING_ELT(column, r, Rf_mkCharLenCE(pKey, length, CE_NATIVE));
+						pKey += length;
+					}
+				}
+				break;
+			default:
+				memcpy(REAL(column) + r, pKey, sizeof(double));
+				pKey += sizeof(double);
+			}
+		}
+	}
+
+	for (size_t a = 0 ; a < numAggregates ; a++)
+	{
+		const Aggregate &aggregate = m_aggregates[a];
+		const int col = aggregate.column;
+		const bool isTime = (col >= 0 && (m_columns[col].getType() == ValueVector::Date || m_columns[col].getType() == ValueVector::DateTime));
+		const bool keepClass = (isTime && aggregate.function != Aggregate::Sum && aggregate.function != Aggregate::Count);
+
+		// The minimum, maximum and mean of dates are still dates
+		NumericVector values((keepClass)?m_columns[col].allocateColumn(numGroups):Rf_allocVector(REALSXP, numGroups));
+		for (int r = 0 ; r < numGroups ; r++)
+		{
+			const double *pState = &m_state[(order[r].second*numAggregates + a)*2];
+			const double count = pState[0];
+
+			switch(aggregate.function)
+			{
+			case Aggregate::Count:
+				values[r] = count;
+				break;
+			case Aggregate::Sum:
+				values[r] = pState[1];
+				break;
+			case Aggregate::Mean:
+				values[r] = (count > 0)?(pState[1]/count):NA_REAL;
+				break;
+			case Aggregate::Min:
+			case Aggregate::Max:
+				values[r] = (count > 0)?pState[1]:NA_REAL;
+				break;
+			}
+		}
+
+		table[numKeys + a] = values;
+		names[numKeys + a] = aggregateNames[a];
+	}
+
+	table.attr("names") = names;
+	SetOutputClass(table, "data.frame", numGroups);
+	return table;
+}
+
+#ifndef _WIN32
+// Parses chunks of lines like a ParserThread, but instead of keeping the values,
+// adds them to the groups of its own table. The staged values are cleared after
+// each chunk, so the memory use only depends on the number of groups.
+class AggregateThread
+{
+public:
+	AggregateThread(const string &columnSpec, const ColumnOptions &options, const vector<int> &keyColumns,
+			const vector<Aggregate> &aggregates, const vector<Chunk> &chunks, std::atomic<size_t> &nextChunk,
+			const vector<string> &fileNames, int maxLineLength, std::atomic<bool> &interrupt, 
+			ThreadCompletion &completion)
+		: m_columnSpec(columnSpec), m_columns(CreateColumns(columnSpec, options)), 
+		  m_groups(m_columns, keyColumns, aggregates), m_chunks(chunks), m_nextChunk(nextChunk),
+		  m_fileNames(fileNames), m_maxLineLength(maxLineLength), m_interrupt(interrupt), m_completion(completion) { }
+
+	void run();
+	const string &getErrorString() const					{ return m_errorString; }
+	const GroupTable &getGroups() const					{ return m_groups; }
+private:
+	void aggregateChunk(size_t chunkIdx, LineParser &lineParser, char *pBuffer);
+
+	const string &m_columnSpec;
+	vector<ValueVector> m_columns;
+	GroupTable m_groups;
+	const vector<Chunk> &m_chunks;
+	std::atomic<size_t> &m_nextChunk;
+	const vector<string> &m_fileNames;
+	const int m_maxLineLength;
+	std::atomic<bool> &m_interrupt;
+	ThreadCompletion &m_completion;
+	string m_errorString;
+};
+
+void AggregateThread::run()
+{
+	try
+	{
+		ValueVector matrixColumn;
+		LineParser lineParser(GetParseTargets(m_columns, matrixColumn, false));
+		vector<char> buffer(m_maxLineLength+1);
+		size_t c;
+
+		while (m_errorString.length() == 0 && !m_interrupt.load(std::memory_order_relaxed) 
+		       && (c = m_nextChunk++) < m_chunks.size())
+		{
+			aggregateChunk(c, lineParser, &buffer[0]);
+		}
+	}
+	catch (const std::exception &e)
+	{
+		m_errorString = e.what();
+	}
+
+	if (m_errorString.length() > 0)
+		m_interrupt = true;
+
+	m_completion.threadDone();
+}
+
+void AggregateThread::aggregateChunk(size_t chunkIdx, LineParser &lineParser, char *pBuffer)
+{
+	const Chunk &chunk = m_chunks[chunkIdx];
+	const char *pStr = chunk.pStart;
+	uint64_t row = 0;
+
+	while (pStr < chunk.pEnd)
+	{
+		const char *pNewLine = (const char *)memchr(pStr, '\n', chunk.pEnd - pStr);
+		const char *pNext = (pNewLine)?(pNewLine + 1):chunk.pEnd;
+		const size_t lineLen = std::min((size_t)(pNext - pStr), (size_t)m_maxLineLength);
+
+		memcpy(pBuffer, pStr, lineLen);
+		pBuffer[lineLen] = 0;
+
+		int failedCol;
+		const char *pFailedField;
+
+		if (!lineParser.parse(pBuffer, lineLen, failedCol, pFailedField))
+		{
+			if (!pFailedField)
+				m_errorString = getString("Not enough columns on line %d of '%s'", chunk.lineNumber(pStr),
+							  m_fileNames[chunk.fileIdx].c_str());
+			else
+				m_errorString = getString("Unable to interpret '%s' (file '%s', line %d, col %d) as type '%c'",
+							  pFailedField, m_fileNames[chunk.fileIdx].c_str(), chunk.lineNumber(pStr),
+							  failedCol+1, m_columnSpec[failedCol]);
+			return;
+		}
+
+		// Chunks are in file order, so this orders the lines of all threads
+		m_groups.addLastRow(((uint64_t)chunkIdx << 32) + row);
+		row++;
+		pStr = pNext;
+	}
+
+	for (size_t i = 0 ; i < m_columns.size() ; i++)
+		m_columns[i].clear();
+}
+#endif // !_WIN32
+
+// Computes the aggregates per group of the key columns, without storing the
+// rows. Only the key columns and the columns of the aggregates are parsed.
+// [[Rcpp::export]]
+SEXP AggregateCSVColumns(vector<string> fileNames, string columnSpec, vector<string> keyNames, 
+			 vector<string> functions, vector<string> aggregateColumns, vector<string> aggregateNames,
+			 bool hasHeaders, int numThreads, int maxLineLength, string dateFormat, string timeFormat,
+			 vector<string> trueValues, vector<string> falseValues)
+{
+	CheckReadSettings(maxLineLength, numThreads);
+
+	if (fileNames.size() == 0)
+		Throw("No input files were specified");
+	if (keyNames.size() == 0)
+		Throw("At least one column to group by is needed");
+	if (functions.size() != aggregateColumns.size() || functions.size() != aggregateNames.size())
+		Throw("Internal error: inconsistent description of the aggregates");
+
+	ColumnOptions options;
+	options.dateFormat = dateFormat;
+	options.timeFormat = timeFormat;
+	options.logicalTokens.setTokens(trueValues, falseValues);
+
+	const string &fileName = fileNames[0];
+	FILE *pFile = OpenInputFile(fileName);
+	AutoCloseFile autoCloser(pFile);
+	vector<string> names;
+
+	columnSpec = GetColumnSpecAndColumnNames(fileName, pFile, columnSpec, hasHeaders, options, names);
+
+	// Everything that isn't needed is skipped while parsing
+	ColumnSelection selection;
+	selection.names = keyNames;
+	for (size_t a = 0 ; a < aggregateColumns.size() ; a++)
+	{
+		if (aggregateColumns[a].length() > 0)
+			selection.names.push_back(aggregateColumns[a]);
+	}
+	columnSpec = SelectColumns(fileName, columnSpec, names, selection);
+
+	vector<int> keyColumns;
+	for (size_t k = 0 ; k < keyNames.size() ; k++)
+		keyColumns.push_back((int)(std::find(names.begin(), names.end(), keyNames[k]) - names.begin()));
+
+	vector<Aggregate> aggregates(functions.size());
+	for (size_t a = 0 ; a < functions.size() ; a++)
+	{
+		const string &f = functions[a];
+		if (f == "count")
+			aggregates[a].function = Aggregate::Count;
+		else if (f == "sum")
+			aggregates[a].function = Aggregate::Sum;
+		else if (f == "mean")
+			aggregates[a].function = Aggregate::Mean;
+		else if (f == "min")
+			aggregates[a].function = Aggregate::Min;
+		else if (f == "max")
+			aggregates[a].function = Aggregate::Max;
+		else
+			Throw("Unknown aggregate function '%s', should be 'count', 'sum', 'mean', 'min' or 'max'", f.c_str());
+
+		aggregates[a].column = -1;
+		if (aggregateColumns[a].length() > 0)
+		{
+			const int col = (int)(std::find(names.begin(), names.end(), aggregateColumns[a]) - names.begin());
+			if (columnSpec[col] == 's')
+				Throw("Can't compute '%s' of column '%s', which contains strings", f.c_str(), aggregateColumns[a].c_str());
+			aggregates[a].column = col;
+		}
+		else if (aggregates[a].function != Aggregate::Count)
+			Throw("The aggregate function '%s' needs a column", f.c_str());
+	}
+
+#ifdef _WIN32
+	if (numThreads != 1)
+	{
+		numThreads = 1;
+		Rcerr << "Parellel interpretation of numbers is not available on Win32 platform, reverting to single thread" << endl;
+	}
+
+	// Line by line, in this thread
+	vector<ValueVector> columns = CreateColumns(columnSpec, options);
+	ValueVector matrixColumn;
+	LineParser lineParser(GetParseTargets(columns, matrixColumn, false));
+	GroupTable groups(columns, keyColumns, aggregates);
+	vector<char> buffer(maxLineLength);
+	uint64_t position = 0;
+
+	for (size_t f = 0 ; f < fileNames.size() ; f++)
+	{
+		FILE *pCurFile = pFile;
+		FILE *pOtherFile = (f > 0)?OpenInputFile(fileNames[f]):0;
+		AutoCloseFile otherCloser(pOtherFile);
+
+		if (pOtherFile)
+		{
+			CheckFileHeader(fileNames[f], pOtherFile, columnSpec, hasHeaders, options, names, fileName);
+			pCurFile = pOtherFile;
+		}
+
+		SerialLineReader reader(pCurFile);
+		int lineNumber = (hasHeaders)?2:1;
+		size_t lineLength;
+
+		while (reader.next(&buffer[0], maxLineLength, lineLength))
+		{
+			int failedCol;
+			const char *pFailedField;
+
+			if (!lineParser.parse(&buffer[0], lineLength, failedCol, pFailedField))
+			{
+				if (!pFailedField)
+					Throw("Not enough columns on line %d of '%s'", lineNumber, fileNames[f].c_str());
+
+				Throw("Unable to interpret '%s' (file '%s', line %d, col %d) as type '%c'",
+				      pFailedField, fileNames[f].c_str(), lineNumber, failedCol+1, columnSpec[failedCol]);
+			}
+
+			groups.addLastRow(position++);
+
+			if ((lineNumber++ & 0xFFFF) == 0)
+			{
+				for (size_t i = 0 ; i < columns.size() ; i++)
+					columns[i].clear();
+				if (UserInterruptPending())
+					Throw("Reading was interrupted by the user");
+			}
+		}
+	}
+
+	return groups.createTable(keyNames, aggregateNames);
+#else
+	MappedFiles mappedFiles;
+	vector<Chunk> chunks;
+	size_t totalBytes = 0;
+	vector<const char *> dataStart(fileNames.size()), dataEnd(fileNames.size());
+
+	for (size_t f = 0 ; f < fileNames.size() ; f++)
+	{
+		FILE *pOtherFile = (f > 0)?OpenInputFile(fileNames[f]):0;
+		AutoCloseFile otherCloser(pOtherFile);
+
+		if (pOtherFile)
+			CheckFileHeader(fileNames[f], pOtherFile, columnSpec, hasHeaders, options, names, fileName);
+
+		size_t length = 0;
+		const char *pData = mappedFiles.map((pOtherFile)?pOtherFile:pFile, fileNames[f], 0, length);
+		dataEnd[f] = pData + length;
+		dataStart[f] = (hasHeaders)?SkipFirstLine(pData, dataEnd[f]):pData;
+		totalBytes += dataEnd[f] - dataStart[f];
+	}
+
+	if (numThreads > 1)
+		numThreads = ChooseNumThreads(numThreads, totalBytes, dataStart[0], std::min((size_t)(dataEnd[0] - dataStart[0]), (size_t)131072),
+					      columnSpec, options);
+
+	// The chunks are kept fairly small, since the values of a chunk are staged
+	// before they're added to the groups
+	const size_t chunkSize = std::min(std::max(totalBytes/(numThreads*8), (size_t)65536), (size_t)(16*1024*1024));
+	for (size_t f = 0 ; f < fileNames.size() ; f++)
+		AddChunks(f, dataStart[f], dataEnd[f], (hasHeaders)?2:1, chunkSize, chunks);
+
+	std::atomic<size_t> nextChunk(0);
+	std::atomic<bool> interrupt(false);
+	ThreadCompletion threadCompletion;
+	vector<std::unique_ptr<AggregateThread> > aggregateThreads;
+	vector<std::thread> threads;
+	string waitError;
+
+	try
+	{
+		for (int i = 0 ; i < numThreads ; i++)
+		{
+			aggregateThreads.push_back(std::unique_ptr<AggregateThread>(new AggregateThread(columnSpec, options, 
+						   keyColumns, aggregates, chunks, nextChunk, fileNames, maxLineLength, 
+						   interrupt, threadCompletion)));
+			threadCompletion.threadStarting();
+			threads.push_back(std::thread(&AggregateThread::run, aggregateThreads.back().get()));
+		}
+	}
+	catch (const std::exception &e)
+	{
+		threadCompletion.threadDone();
+		interrupt = true;
+		waitError = getString("Unable to start a thread: %s", e.what());
+	}
+
+	while (!threadCompletion.waitFor(100))
+	{
+		if (waitError.length() == 0 && UserInterruptPending())
+		{
+			waitError = "Reading was interrupted by the user";
+			interrupt = true;
+		}
+	}
+
+	for (size_t i = 0 ; i < threads.size() ; i++)
+		threads[i].join();
+
+	if (waitError.length() > 0)
+		Throw("%s", waitError.c_str());
+
+	for (size_t i = 0 ; i < aggregateThreads.size() ; i++)
+	{
+		const string &errorString = aggregateThreads[i]->getErrorString();
+		if (errorString.length() > 0)
+			Throw("%s", errorString.c_str());
+	}
+
+	vector<ValueVector> columns = CreateColumns(columnSpec, options);
+	GroupTable groups(columns, keyColumns, aggregates);
+	for (size_t i = 0 ; i < aggregateThreads.size() ; i++)
+		groups.merge(aggregateThreads[i]->getGroups());
+
+	return groups.createTable(keyNames, aggregateNames);
+#endif // _WIN32
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool ReadInputLine(FILE *fi, string &line)
+{
+	if (fi == 0)
+		return false;
+
+	// Read the line in large blocks, fgets stops at the newline so no
+	// seeking back is needed afterwards
+	char block[65536];
+	bool gotchar = false;
+
+	line.clear();
+	while (fgets(block, sizeof(block), fi))
+	{
+		gotchar = true;
+
+		size_t len = strlen(block);
+		line.append(block, len);
+
+		if (len > 0 && block[len-1] == '\n') // stop here
+			break;
+	}
+
+	if (!gotchar)
+		return false;
+
+	size_t l = line.length();
+	if (l > 0 && line[l-1] == '\n')
+		l--;
+	if (l > 0 && line[l-1] == '\r')
+		l--;
+	line.resize(l);
+
+	return true;
+}
+
+bool MemoryLineSource::readLine(string &line)
+{
+	if (m_pPos >= m_pEnd)
+		return false;
+
+	const char *pNewLine = (const char *)memchr(m_pPos, '\n', m_pEnd - m_pPos);
+	const char *pNext = (pNewLine)?(pNewLine + 1):m_pEnd;
+
+	size_t l = ((pNewLine)?pNewLine:m_pEnd) - m_pPos;
+	if (l > 0 && m_pPos[l-1] == '\r')
+		l--;
+
+	line.assign(m_pPos, l);
+	m_pPos = pNext;
+	return true;
+}
+
+enum CharClass { CharNormal = 0, CharSeparator, CharQuote, CharComment };
+
+void SplitLine(const string &line, vector<string> &args, const string &separatorChars,
+	       const string &quoteChars, const string &commentStartChars, bool ignoreZeroLengthFields)
+{
+	unsigned char charClass[256];
+	memset(charClass, CharNormal, sizeof(charClass));
+
+	for (size_t i = 0 ; i < quoteChars.length() ; i++)
+		charClass[(unsigned char)quoteChars[i]] = CharQuote;
+	for (size_t i = 0 ; i < commentStartChars.length() ; i++)
+		charClass[(unsigned char)commentStartChars[i]] = CharComment;
+	for (size_t i = 0 ; i < separatorChars.length() ; i++)
+		charClass[(unsigned char)separatorChars[i]] = CharSeparator;
+
+	vector<string> arguments;
+	string curString;
+	const char *pStr = line.data();
+	const char *pEnd = pStr + line.length();
+
+	while (pStr < pEnd)
+	{
+		const char *pRun = pStr;
+		while (pRun < pEnd && charClass[(unsigned char)*pRun] == CharNormal)
+			pRun++;
+
+		curString.append(pStr, pRun - pStr);
+		pStr = pRun;
+		if (pStr == pEnd)
+			break;
+
+		unsigned char c = charClass[(unsigned char)*pStr];
+		if (c == CharSeparator)
+		{
+			if (curString.length() > 0 || !ignoreZeroLengthFields)
+				arguments.push_back(curString);
+			curString.clear();
+			pStr++;
+		}
+		else if (c == CharQuote)
+		{
+			const char quoteStartChar = *pStr++;
+			const char *pClose = (const char *)memchr(pStr, quoteStartChar, pEnd - pStr);
+			if (!pClose)
+				pClose = pEnd;
+
+			curString.append(pStr, pClose - pStr);
+			pStr = (pClose < pEnd)?(pClose + 1):pEnd;
+		}
+		else // comment, ignore the rest of the line
+			break;
+	}
+
+	if (curString.length() > 0 || !ignoreZeroLengthFields)
+		arguments.push_back(curString);
+
+	args.swap(arguments);
+}
+
+LogicalTokens::LogicalTokens() : m_numTokens(0)
+{
+	for (int i = 0 ; i < TableSize ; i++)
+		m_used[i] = false;
+}
+
+void LogicalTokens::insert(const string &token, int value)
+{
+	if (token.length() == 0 || token.length() > 8)
+		Throw("Logical token '%s' must contain between one and eight characters", token.c_str());
+	if (m_numTokens >= MaxTokens)
+		Throw("Too many logical tokens, at most %d are allowed", (int)MaxTokens);
+
+	uint64_t key = 0;
+	for (size_t i = 0 ; i < token.length() ; i++)
+	{
+		unsigned char c = (unsigned char)token[i];
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+			Throw("Logical token '%s' should not contain whitespace", token.c_str());
+		key |= ((uint64_t)c) << (8*i);
+	}
+
+	unsigned int s = slot(key);
+	while (m_used[s])
+	{
+		if (m_keys[s] == key)
+		{
+			if (m_values[s] != value)
+				Throw("Logical token '%s' is used for more than one value", token.c_str());
+			return;
+		}
+		s = (s+1)&(TableSize-1);
+	}
+
+	m_used[s] = true;
+	m_keys[s] = key;
+	m_values[s] = value;
+	m_numTokens++;
+}
+
+void LogicalTokens::setTokens(const vector<string> &trueValues, const vector<string> &falseValues)
+{
+	for (size_t i = 0 ; i < trueValues.size() ; i++)
+		insert(trueValues[i], 1);
+	for (size_t i = 0 ; i < falseValues.size() ; i++)
+		insert(falseValues[i], 0);
+
+	int value;
+	if (!lookup("NA", value))
+		insert("NA", NA_LOGICAL);
+}
+
+inline bool LogicalTokens::lookup(const char *pStr, int &value) const
+{
+	pStr = ValueVector::skipWhite(pStr);
+
+	uint64_t key = 0;
+	int len = 0;
+	for ( ; len < 8 ; len++)
+	{
+		unsigned char c = (unsigned char)pStr[len];
+		if (c == '\0' || c == ' ' || c == '\t' || c == '\r' || c == '\n')
+			break;
+		key |= ((uint64_t)c) << (8*len);
+	}
+	if (len == 0 || *ValueVector::skipWhite(pStr+len) != '\0')
+		return false;
+
+	unsigned int s = slot(key);
+	while (m_used[s])
+	{
+		if (m_keys[s] == key)
+		{
+			value = m_values[s];
+			return true;
+		}
+		s = (s+1)&(TableSize-1);
+	}
+	return false;
+}
+
+StringPool::StringPool() : m_lookups(0), m_dedup(true)
+{
+}
+
+// FNV-1a
+inline uint32_t StringPool::hash(const char *pStr, size_t len)
+{
+	uint32_t h = 2166136261U;
+	for (size_t i = 0 ; i < len ; i++)
+	{
+		h ^= (unsigned char)pStr[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+inline int StringPool::append(const char *pStr, size_t len)
+{
+	int idx = (int)m_offsets.size();
+	m_offsets.push_back(m_data.size());
+	m_lengths.push_back((int)len);
+	m_data.insert(m_data.end(), pStr, pStr + len);
+	return idx;
+}
+
+void StringPool::rehash(size_t newSize)
+{
+	m_table.assign(newSize, -1);
+	const size_t mask = newSize-1;
+	for (size_t i = 0 ; i < m_hashes.size() ; i++)
+	{
+		size_t s = m_hashes[i] & mask;
+		while (m_table[s] >= 0)
+			s = (s+1) & mask;
+		m_table[s] = (int)i;
+	}
+}
+
+inline int StringPool::add(const char *pStr, size_t len)
+{
+	if (!m_dedup)
+		return append(pStr, len);
+
+	// If most values turn out to be distinct (e.g. identifiers), the hashing
+	// is just overhead, so stop deduplicating
+	m_lookups++;
+	if (m_lookups == 4096 && m_offsets.size() > m_lookups/2)
+	{
+		m_dedup = false;
+		vector<int>().swap(m_table);
+		vector<uint32_t>().swap(m_hashes);
+		return append(pStr, len);
+	}
+
+	if (m_table.size() < 2*(m_hashes.size()+1))
+		rehash((m_table.size() == 0)?1024:(m_table.size()*2));
+
+	const uint32_t h = hash(pStr, len);
+	const size_t mask = m_table.size()-1;
+	size_t s = h & mask;
+	while (1)
+	{
+		int idx = m_table[s];
+		if (idx < 0)
+			break;
+		if (m_hashes[idx] == h && m_lengths[idx] == (int)len && memcmp(getString(idx), pStr, len) == 0)
+			return idx;
+		s = (s+1) & mask;
+	}
+
+	int idx = append(pStr, len);
+	m_hashes.push_back(h);
+	m_table[s] = idx;
+	return idx;
+}
+
+// Must be called from the main thread, creates the CHARSXPs in the order in
+// which the distinct strings were first encountered
+size_t StringPool::getMemoryUsage() const
+{
+	return m_data.capacity() + m_offsets.capacity()*sizeof(size_t) + m_lengths.capacity()*sizeof(int)
+	       + m_hashes.capacity()*sizeof(uint32_t) + m_table.capacity()*sizeof(int);
+}
+
+SEXP StringPool::createCharacterVector() const
+{
+	const int num = size();
+	StringVector v(num);
+
+	for (int i = 0 ; i < num ; i++)
+		SET_STRING_ELT(v, i, Rf_mkCharLenCE(getString(i), getLength(i), CE_NATIVE));
+
+	return v;
+}
+
+int LazyStrings::addPool(StringPool &pool)
+{
+	if (m_numStrings + pool.size() > (size_t)INT_MAX)
+		Throw("Too many distinct strings for a lazily materialized column");
+
+	const int start = (int)m_numStrings;
+	m_poolStart.push_back(start);
+	m_numStrings += pool.size();
+
+	m_pools.push_back(StringPool());
+	std::swap(m_pools.back(), pool);
+	return start;
+}
+
+void LazyStrings::permute(const vector<int> &order)
+{
+	vector<int> rows(m_rows.size());
+	for (size_t i = 0 ; i < rows.size() ; i++)
+		rows[i] = m_rows[order[i]];
+	m_rows.swap(rows);
+}
+
+// Must be called from the main thread, like every function that creates CHARSXPs
+SEXP LazyStrings::getElement(size_t row) const
+{
+	const int idx = m_rows[row];
+	if (idx < 0)
+		return NA_STRING;
+
+	// There's one pool per thread, so this search is short
+	const size_t p = std::upper_bound(m_poolStart.begin(), m_poolStart.end(), idx) - m_poolStart.begin() - 1;
+	const StringPool &pool = m_pools[p];
+	const int poolIdx = idx - m_poolStart[p];
+	return Rf_mkCharLenCE(pool.getString(poolIdx), pool.getLength(poolIdx), CE_NATIVE);
+}
+
+#ifdef HAVE_ALTREP
+// An ALTREP string vector: 'data1' is an external pointer to the LazyStrings,
+// 'data2' is R_NilValue until a pointer to all elements is needed. Then the
+// column is materialized as an ordinary character vector, which is stored in
+// 'data2', and the LazyStrings are freed.
+static R_altrep_class_t s_lazyStringClass;
+
+static LazyStrings *GetLazyStrings(SEXP x)
+{
+	return (LazyStrings *)R_ExternalPtrAddr(R_altrep_data1(x));
+}
+
+static void LazyStringsFinalizer(SEXP ptr)
+{
+	delete (LazyStrings *)R_ExternalPtrAddr(ptr);
+	R_ClearExternalPtr(ptr);
+}
+
+static SEXP MaterializeLazyStrings(SEXP x)
+{
+	SEXP materialized = R_altrep_data2(x);
+	if (materialized != R_NilValue)
+		return materialized;
+
+	LazyStrings *pStrings = GetLazyStrings(x);
+	const R_xlen_t num = (R_xlen_t)pStrings->size();
+
+	materialized = PROTECT(Rf_allocVector(STRSXP, num));
+	for (R_xlen_t i = 0 ; i < num ; i++)
+		SET_STRING_ELT(materialized, i, pStrings->getElement(i));
+
+	R_set_altrep_data2(x, materialized);
+	UNPROTECT(1);
+
+	LazyStringsFinalizer(R_altrep_data1(x));
+	return materialized;
+}
+
+static R_xlen_t LazyStringsLength(SEXP x)
+{
+	SEXP materialized = R_altrep_data2(x);
+	if (materialized != R_NilValue)
+		return XLENGTH(materialized);
+	return (R_xlen_t)GetLazyStrings(x)->size();
+}
+
+static SEXP LazyStringsElt(SEXP x, R_xlen_t i)
+{
+	SEXP materialized = R_altrep_data2(x);
+	if (materialized != R_NilValue)
+		return STRING_ELT(materialized, i);
+	return GetLazyStrings(x)->getElement(i);
+}
+
+static void LazyStringsSetElt(SEXP x, R_xlen_t i, SEXP value)
+{
+	SET_STRING_ELT(MaterializeLazyStrings(x), i, value);
+}
+
+static void *LazyStringsDataptr(SEXP x, Rboolean writeable)
+{
+	return DATAPTR(MaterializeLazyStrings(x));
+}
+
+static const void *LazyStringsDataptrOrNull(SEXP x)
+{
+	SEXP materialized = R_altrep_data2(x);
+	if (materialized == R_NilValue)
+		return 0;
+	return DATAPTR(materialized);
+}
+
+static Rboolean LazyStringsInspect(SEXP x, int pre, int deep, int pvec, void (*inspectSubtree)(SEXP, int, int, int))
+{
+	Rprintf("lazy strings (len=%d, materialized=%s)\n", (int)LazyStringsLength(x), 
+	        (R_altrep_data2(x) != R_NilValue)?"T":"F");
+	return TRUE;
+}
+
+void InitLazyStringClass(DllInfo *pDll)
+{
+	s_lazyStringClass = R_make_altstring_class("lazy_strings", "readcsvcolumns", pDll);
+
+	R_set_altrep_Length_method(s_lazyStringClass, LazyStringsLength);
+	R_set_altrep_Inspect_method(s_lazyStringClass, LazyStringsInspect);
+	R_set_altvec_Dataptr_method(s_lazyStringClass, LazyStringsDataptr);
+	R_set_altvec_Dataptr_or_null_method(s_lazyStringClass, LazyStringsDataptrOrNull);
+	R_set_altstring_Elt_method(s_lazyStringClass, LazyStringsElt);
+	R_set_altstring_Set_elt_method(s_lazyStringClass, LazyStringsSetElt);
+}
+
+SEXP CreateLazyStringColumn(std::unique_ptr<LazyStrings> pStrings)
+{
+	SEXP ptr = PROTECT(R_MakeExternalPtr(pStrings.get(), R_NilValue, R_NilValue));
+	R_RegisterCFinalizerEx(ptr, LazyStringsFinalizer, TRUE);
+	pStrings.release();
 
-		Rcout << "Detected column specification is '" << columnSpec << "'" << endl;
+	SEXP column = R_new_altrep(s_lazyStringClass, ptr, R_NilValue);
+	UNPROTECT(1);
+	return column;
+}
 
-		if (fseek(pFile, 0, SEEK_SET) != 0)
-			Throw("Unable to rewind the file (needed after establising the column types)");
+// Gathers the staged values of a string column from all threads: the rows
+// of output chunk c are chunkRows[c] rows from the column of thread
+// chunkThread[c], starting at row chunkFirstRow[c]
+SEXP CreateLazyStringColumn(const vector<ValueVector *> &threadColumns, const vector<int> &chunkThread,
+			    const vector<size_t> &chunkFirstRow, const vector<size_t> &chunkRows, size_t totalRows)
+{
+	std::unique_ptr<LazyStrings> pStrings(new LazyStrings());
+	vector<int> poolStart(threadColumns.size());
 
-		if (hasHeaders)
-		{
-			// In this case, we need to skip the first line again
-			if (!ReadInputLine(pFile, line))
-				Throw("Unable to re-read the first line (needed after establising the column types)");
-		}
+	for (size_t t = 0 ; t < threadColumns.size() ; t++)
+	{
+		StringPool pool;
+		threadColumns[t]->takeStringPool(pool);
+		poolStart[t] = pStrings->addPool(pool);
 	}
 
-	if (hasHeaders)
-		names = parts;
-	else // Use default column names
+	vector<int> &rows = pStrings->getRows();
+	rows.resize(totalRows);
+
+	size_t outPos = 0;
+	for (size_t c = 0 ; c < chunkRows.size() ; c++)
 	{
-		char tmp[1024];
-		
-		names.clear();
-		for (int i = 1 ; i <= (int)parts.size() ; i++)
-		{
-			sprintf(tmp, "col_%03d", i);
-			names.push_back(tmp);
-		}
+		const int t = chunkThread[c];
+		threadColumns[t]->copyStringIndices(&rows[0] + outPos, chunkFirstRow[c], chunkRows[c], poolStart[t]);
+		outPos += chunkRows[c];
 	}
 
-	return columnSpec;
+	for (size_t t = 0 ; t < threadColumns.size() ; t++)
+		threadColumns[t]->release();
+
+	return CreateLazyStringColumn(std::move(pStrings));
 }
 
-inline char *gotoNextLine(char *pStr)
+// Reorders a lazy string column that hasn't been materialized yet, without
+// creating any of its strings. Returns false for other columns.
+bool PermuteLazyStrings(SEXP column, const vector<int> &order)
 {
-	char c = '\0';
-	while (1)
-	{
-		c = *pStr;
-		if (c == '\0')
-			break;
+	if (!ALTREP(column) || !R_altrep_inherits(column, s_lazyStringClass) || R_altrep_data2(column) != R_NilValue)
+		return false;
 
-		if (c == '\n')
-		{
-			pStr++;
-			break;
-		}
+	GetLazyStrings(column)->permute(order);
+	return true;
+}
 
-		pStr++;
-	}
+extern "C" attribute_visible void R_init_readcsvcolumns(DllInfo *pDll)
+{
+	InitLazyStringClass(pDll);
+}
+#endif // HAVE_ALTREP
 
-	return pStr;
+ValueVector::ValueVector(VectorType t) : m_vectorType(t), m_pOptions(0)
+{ 
 }
 
-// [[Rcpp::export]]
-List ReadCSVColumns(string fileName, string columnSpec, int maxLineLength, bool hasHeaders, int numThreads) 
+ValueVector::~ValueVector() 
+{ 
+}
+
+void ValueVector::setType(VectorType t)
 {
-	if (numThreads < 1)
-		Throw("Number of threads must be at least one");
+	if (m_vectorInt.size() || m_vectorDouble.size() || m_stringPool.size())
+		throw Rcpp::exception("Internal error: vectors should be empty when calling setType()");
 
-	if (maxLineLength <= 0)
-		Throw("Maximum line length must be larger than 0 (is %d)", maxLineLength);
+	m_vectorType = t;
+}
 
-	FILE *pFile = fopen(fileName.c_str(), "rt");
-	if (!pFile)
-		Throw("Unable to open file '%s'", fileName.c_str());
+inline bool ValueVector::processInt(const char *pStr)
+{
+	int x;
+	if (!parseAsInt(pStr, x))
+		return false;
 
-	AutoCloseFile autoCloser(pFile);
-	vector<string> names;
+	m_vectorInt.push_back(x);
+	return true;
+}
 
-	columnSpec = GetColumnSpecAndColumnNames(fileName, pFile, columnSpec, hasHeaders, names);
-	const size_t numCols = columnSpec.length();
+inline bool ValueVector::processIntAsDouble(const char *pStr)
+{
+	int x;
+	if (!parseAsInt(pStr, x))
+		return false;
 
-	if (numCols == 0)
-		Throw("No columns found in file '%s'", fileName.c_str());
+	m_vectorDouble.push_back((x == NA_INTEGER)?NA_REAL:(double)x);
+	return true;
+}
 
-	size_t ignoreColumns = 0;
-	for (size_t i = 0 ; i < numCols ; i++)
+inline bool ValueVector::processLogical(const char *pStr)
+{
+	int x;
+	if (!m_pOptions->logicalTokens.lookup(pStr, x))
+		return false;
+
+	m_vectorInt.push_back(x);
+	return true;
+}
+
+inline bool ValueVector::processDouble(const char *pStr)
+{
+	double y;
+	if (!parseAsDouble(pStr, y))
+		return false;
+
+	m_vectorDouble.push_back(y);
+	return true;
+}
+
+inline bool ValueVector::processDate(const char *pStr)
+{
+	double y;
+	if (!parseAsDate(pStr, m_pOptions->dateFormat, y))
+		return false;
+
+	m_vectorDouble.push_back(y);
+	return true;
+}
+
+inline bool ValueVector::processDateTime(const char *pStr)
+{
+	double y;
+	if (!parseAsDateTime(pStr, m_pOptions->timeFormat, y))
+		return false;
+
+	m_vectorDouble.push_back(y);
+	return true;
+}
+
+inline bool ValueVector::processString(const char *pStr, size_t len)
+{
+	if (m_pOptions && m_pOptions->hasStringNA && len == m_pOptions->stringNA.length() && 
+	    memcmp(pStr, m_pOptions->stringNA.data(), len) == 0)
 	{
-		if (columnSpec[i] == '.')
-			ignoreColumns++;
+		m_vectorInt.push_back(-1); // not a StringPool index
+		return false;
 	}
 
-	if (ignoreColumns == numCols)
-		Throw("All columns will be ignored by the given column specification");
+	m_vectorInt.push_back(m_stringPool.add(pStr, len));
+	return true;
+}
 
-	List listOfVectors;
+// Only used for fields that couldn't be interpreted or that are missing
+void ValueVector::addNA()
+{
+	switch(m_vectorType)
+	{
+	case Ignore:
+		break;
+	case Integer:
+		m_vectorInt.push_back(NA_INTEGER);
+		break;
+	case Logical:
+		m_vectorInt.push_back(NA_LOGICAL);
+		break;
+	case Double:
+	case Date:
+	case DateTime:
+		m_vectorDouble.push_back(NA_REAL);
+		break;
+	case String:
+		m_vectorInt.push_back(-1); // not a StringPool index
+		break;
+	default:
+		throw Rcpp::exception("Internal error: unknown m_vectorType in addNA");
+	}
+}
 
-#ifdef _WIN32
-	if (numThreads != 1)
+bool ValueVector::processWithCheck(const char *pStr)
+{ 
+	switch(m_vectorType)
 	{
-		numThreads = 1;
-		Rcerr << "Parellel interpretation of numbers is not available on Win32 platform, reverting to single thread" << endl;
+	case Ignore:
+		return true;
+	case Integer:
+		return processInt(pStr);
+	case Logical:
+		return processLogical(pStr);
+	case Double:
+		return processDouble(pStr);
+	case Date:
+		return processDate(pStr);
+	case DateTime:
+		return processDateTime(pStr);
+	case String:
+		processString(pStr, strlen(pStr));
+		return true;
+	default:
+		throw Rcpp::exception("Internal error: unknown m_vectorType");
 	}
-#endif // _WIN32
+}
 
-	if (numThreads == 1)
+void ValueVector::setDateTimeClass(NumericVector &v) const
+{
+	if (m_vectorType == Date)
+		v.attr("class") = "Date";
+	else if (m_vectorType == DateTime)
 	{
-		vector<ValueVector> columns(numCols);
-		vector<char> buffer(maxLineLength);
-		char *buff = &(buffer[0]);
+		v.attr("class") = CharacterVector::create("POSIXct", "POSIXt");
+		v.attr("tzone") = "UTC";
+	}
+}
 
-		for (size_t i = 0 ; i < numCols ; i++)
-		{
-			switch(columnSpec[i])
-			{
-			case 'i':
-				columns[i].setType(ValueVector::Integer);
-				break;
-			case 'r':
-				columns[i].setType(ValueVector::Double);
-				break;
-			case 's':
-				columns[i].setType(ValueVector::String);
-				break;
-			case '.':
-				columns[i].setType(ValueVector::Ignore);
-				break;
-			default:
-				Throw("Invalid column type '%c'", columnSpec[i]);
-			}
-		}
+void ValueVector::addColumnToList(List &listOfVectors, int listPos)
+{
+	const size_t num = getEntries();
 
-		int lineNumber = 2;
-		int numElements = 0;
+	listOfVectors[listPos] = allocateColumn(num);
+	SEXP column = listOfVectors[listPos];
 
-		while (fgets(buff, maxLineLength, pFile))
-		{
-			buff[maxLineLength-1] = 0;
+	if (m_vectorType == String)
+	{
+		StringVector distinct(createDistinctStrings());
+		copyToColumn(column, 0, 0, num, distinct);
+	}
+	else
+		copyToColumn(column, 0, 0, num, R_NilValue);
+}
 
-			char *pBuff = buff;
-			char *pPtr = 0;
+void ValueVector::takeStringPool(StringPool &dest)
+{
+	std::swap(m_stringPool, dest);
+}
 
-			for (int i = 0 ; i < numCols ; i++)
-			{
-				char *pPart = StrTok(pBuff, ',', &pPtr);
-				pBuff = 0;
+void ValueVector::copyStringIndices(int *pDest, size_t srcPos, size_t num, int base) const
+{
+	const int *pSrc = &m_vectorInt[0] + srcPos;
+	for (size_t i = 0 ; i < num ; i++)
+		pDest[i] = (pSrc[i] < 0)?-1:(pSrc[i] + base);
+}
 
-				if (!pPart)
-					Throw("Not enough columns on line %d", lineNumber);
+SEXP ValueVector::allocateColumn(size_t totalEntries) const
+{
+	switch(m_vectorType)
+	{
+	case Ignore:
+		throw Rcpp::exception("Internal error: 'Ignore' should not be used in allocateColumn");
+	case Integer:
+		return IntegerVector(totalEntries);
+	case Logical:
+		return LogicalVector(totalEntries);
+	case Double:
+	case Date:
+	case DateTime:
+		{
+			NumericVector v(totalEntries);
+			setDateTimeClass(v);
+			return v;
+		}
+	case String:
+		return StringVector(totalEntries);
+	default:
+		throw Rcpp::exception("Internal error: unknown m_vectorType in allocateColumn");
+	}
+}
 
-				int colNum = i+1;
-				if (!columns[i].processWithCheck(pPart, colNum == numCols))
-				{
-					Throw("Unable to interpret '%s' (line %d, col %d) as type '%c'",
-					      pPart, lineNumber, colNum, columnSpec[i]);
-				}
-			}
+// Copies 'num' entries starting at 'srcPos' to position 'destPos' in 'column'. For
+// string columns, 'distinctStrings' must be the result of createDistinctStrings
+void ValueVector::copyToColumn(SEXP column, size_t destPos, size_t srcPos, size_t num, SEXP distinctStrings) const
+{
+	if (num == 0)
+		return;
 
-			lineNumber++;
-			numElements++;
+	switch(m_vectorType)
+	{
+	case Ignore:
+		throw Rcpp::exception("Internal error: 'Ignore' should not be used in copyToColumn");
+	case Integer:
+	case Logical:
+	case Double:
+	case Date:
+	case DateTime:
+		copyToBuffer(getDataPointer(column), destPos, srcPos, num);
+		break;
+	case String:
+		for (size_t i = 0 ; i < num ; i++)
+		{
+			const int idx = m_vectorInt[srcPos + i];
+			SET_STRING_ELT(column, destPos + i, (idx < 0)?NA_STRING:STRING_ELT(distinctStrings, idx));
 		}
+		break;
+	default:
+		throw Rcpp::exception("Internal error: unknown m_vectorType in copyToColumn");
+	}
+}
 
-		//cout << "Data loaded, storing in R struct" << endl;
+SEXP ValueVector::allocateMatrix(size_t numRows, int numCols) const
+{
+	if (m_vectorType == Integer)
+		return IntegerMatrix(numRows, numCols);
+	if (m_vectorType == Double)
+		return NumericMatrix(numRows, numCols);
+	throw Rcpp::exception("Internal error: unexpected m_vectorType in allocateMatrix");
+}
 
-		CharacterVector nameVec;
-		for (size_t i = 0 ; i < columns.size() ; i++)
+// The rows are stored one after the other, but R's matrices are column-major.
+// The transpose is done in tiles to stay cache friendly when there are many columns.
+template<class T>
+void TransposeRows(const T *pSrc, T *pDest, size_t totalRows, size_t destRow, size_t num, int numCols)
+{
+	const size_t tile = 64;
+	for (size_t r0 = 0 ; r0 < num ; r0 += tile)
+	{
+		const size_t r1 = std::min(r0 + tile, num);
+		for (size_t c0 = 0 ; c0 < (size_t)numCols ; c0 += tile)
 		{
-			if (!columns[i].ignore())
+			const size_t c1 = std::min(c0 + tile, (size_t)numCols);
+			for (size_t c = c0 ; c < c1 ; c++)
 			{
-				//if (hasHeaders)
-				nameVec.push_back(names[i]);
-
-				columns[i].addColumnToList(listOfVectors);
+				T *pDestCol = pDest + c*totalRows + destRow;
+				for (size_t r = r0 ; r < r1 ; r++)
+					pDestCol[r] = pSrc[r*numCols + c];
 			}
 		}
-
-		//if (hasHeaders)
-		listOfVectors.attr("names") = nameVec;
 	}
-	else // Parallel version using mmap and openmp
-	{
-#ifndef _WIN32
-		int fileDesc = fileno(pFile);
-		if (fileDesc < 0)
-			Throw("Internal error: unable to get file descriptor of opened file");
-
-		if (fseek(pFile, 0, SEEK_END) != 0)
-			Throw("Couldn't seek to the end of the file");
-
-		long fileSize = ftell(pFile);
-		
-		// Using fileSize+1 to make sure it's zero-terminated
-		// From Linux manual page:
-		//   For a file that is not a multiple of the page  size,  the  remaining  memory  
-		//   is  zeroed
-		// From OS X manual page:
-		//   'Any extension beyond the end of the mapped object will be zero-filled.
-		void *pMmapAddr = mmap(0, fileSize+1, PROT_READ, MAP_PRIVATE, fileDesc, 0);
-		if (pMmapAddr == 0)
-			Throw("Unable to use 'mmap' to access file");
-
-		AutoUnMap autoUnMap(pMmapAddr, fileSize); // Make sure munmap is called when done
-
-		Rcout << "Using " << numThreads << " threads to parse fields" << endl;
+}
 
-		char *pStrStart = (char *)pMmapAddr;
-		if (hasHeaders)
-			pStrStart = gotoNextLine(pStrStart);
+void ValueVector::copyToMatrix(SEXP matrix, size_t totalRows, size_t destRow, size_t srcRow, size_t num, int numCols) const
+{
+	if (m_vectorType != Integer && m_vectorType != Double)
+		throw Rcpp::exception("Internal error: unexpected m_vectorType in copyToMatrix");
 
-		vector<vector<ValueVector> > threadColumns(numThreads);
-		vector<string> errorReasons(numThreads);
+	copyToMatrix(getDataPointer(matrix), totalRows, destRow, srcRow, num, numCols);
+}
 
-		size_t lastRealColumn = 0;
+void ValueVector::copyToMatrix(void *pMatrix, size_t totalRows, size_t destRow, size_t srcRow, size_t num, int numCols) const
+{
+	if (num == 0)
+		return;
 
-		for (size_t t = 0 ; t < numThreads ; t++)
-		{
-			threadColumns[t].resize(numCols);
-			for (size_t i = 0 ; i < numCols ; i++)
-			{
-				switch(columnSpec[i])
-				{
-				case 'i':
-					threadColumns[t][i].setType(ValueVector::Integer);
-					lastRealColumn = i;
-					break;
-				case 'r':
-					threadColumns[t][i].setType(ValueVector::Double);
-					lastRealColumn = i;
-					break;
-				case 's':
-					threadColumns[t][i].setType(ValueVector::String);
-					lastRealColumn = i;
-					break;
-				case '.':
-					threadColumns[t][i].setType(ValueVector::Ignore);
-					break;
-				default:
-					Throw("Invalid column type '%c'", columnSpec[i]);
-				}
-			}
-		}
+	if (m_vectorType == Integer)
+		TransposeRows(&m_vectorInt[srcRow*numCols], (int *)pMatrix, totalRows, destRow, num, numCols);
+	else if (m_vectorType == Double)
+		TransposeRows(&m_vectorDouble[srcRow*numCols], (double *)pMatrix, totalRows, destRow, num, numCols);
+}
 
-		volatile bool interrupt = false;
+void *ValueVector::getDataPointer(SEXP column)
+{
+	switch(TYPEOF(column))
+	{
+	case INTSXP:
+		return INTEGER(column);
+	case LGLSXP:
+		return LOGICAL(column);
+	case REALSXP:
+		return REAL(column);
+	default:
+		throw Rcpp::exception("Internal error: unexpected vector type in getDataPointer");
+	}
+}
 
-		vector<ParserThread *> parserThreads(numThreads);
-		for (int i = 0 ; i < numThreads ; i++)
-			parserThreads[i] = new ParserThread(threadColumns[i], errorReasons[i], i,
-			                          numThreads, pStrStart, numCols,hasHeaders, maxLineLength,
-				                  columnSpec, interrupt);
+void ValueVector::copyToBuffer(void *pDest, size_t destPos, size_t srcPos, size_t num) const
+{
+	if (num == 0)
+		return;
 
-		for (int i = 0 ; i < numThreads ; i++)
-			parserThreads[i]->Start();
+	switch(m_vectorType)
+	{
+	case Integer:
+	case Logical:
+		memcpy((int *)pDest + destPos, &m_vectorInt[srcPos], num*sizeof(int));
+		break;
+	case Double:
+	case Date:
+	case DateTime:
+		memcpy((double *)pDest + destPos, &m_vectorDouble[srcPos], num*sizeof(double));
+		break;
+	default: // Strings need the R API, see copyToColumn
+		break;
+	}
+}
 
-		// Wait until everyone's done
-		for (int i = 0 ; i < numThreads ; i++)
-			parserThreads[i]->m_endMutex.Lock();
-		for (int i = 0 ; i < numThreads ; i++)
-			parserThreads[i]->m_endMutex.Unlock();
+// Returns the next comma separated field, which is terminated in place, or
+// NULL if there are no more fields on the line
+inline char *NextField(char *&pPos, char *&pFieldEnd)
+{
+	char *pStart = pPos;
+	if (!pStart)
+		return NULL;
 
-		// Check if an error was encountered
-		for (int i = 0 ; i < numThreads ; i++)
-		{
-			if (errorReasons[i].length() > 0)
-				Throw(errorReasons[i].c_str());
-		}
+	char *pSep = strchr(pStart, ',');
+	if (pSep)
+	{
+		*pSep = 0;
+		pPos = pSep + 1;
+		pFieldEnd = pSep;
+	}
+	else
+	{
+		pPos = NULL;
+		pFieldEnd = pStart + strlen(pStart);
+	}
+	return pStart;
+}
 
-		int totalEntries = 0;
-		for (int i = 0 ; i < numThreads ; i++)
+// T is the type in which the values are stored, which the statistics need
+template<bool (ValueVector::*Process)(const char *), class T, bool WithStats>
+bool ParseFields(ValueVector * const *ppTargets, ColumnStats *pStats, int numCols, char *&pPos, 
+                 int &failedIdx, const char *&pFailedField)
+{
+	char *pFieldEnd;
+	for (int i = 0 ; i < numCols ; i++)
+	{
+		char *pField = NextField(pPos, pFieldEnd);
+		if (!pField || !(ppTargets[i]->*Process)(pField))
 		{
-			// Each column will have the same number of entries, except for columns which are
-			// ignored
-			totalEntries += threadColumns[i][lastRealColumn].getEntries(); 
+			failedIdx = i;
+			pFailedField = pField;
+			return false;
 		}
 
-		Rcout << "Read " << totalEntries << " data lines" << endl;
-
-		CharacterVector nameVec;
-		for (size_t i = 0 ; i < numCols ; i++)
-		{
-			if (!threadColumns[0][i].ignore()) // It's ignored in all threads
-			{
-				//if (hasHeaders)
-				nameVec.push_back(names[i]);
+		if (WithStats)
+			pStats[i].add(ppTargets[i]->lastValue<T>());
+	}
+	return true;
+}
 
-				for (int t = 0 ; t < numThreads ; t++)
-					threadColumns[t][i].addColumnToList(listOfVectors, numThreads, t, totalEntries);
-			}
+template<bool WithStats>
+bool StoreStrings(ValueVector * const *ppTargets, ColumnStats *pStats, int numCols, char *&pPos, 
+                  int &failedIdx, const char *&pFailedField)
+{
+	char *pFieldEnd;
+	for (int i = 0 ; i < numCols ; i++)
+	{
+		char *pField = NextField(pPos, pFieldEnd);
+		if (!pField)
+		{
+			failedIdx = i;
+			pFailedField = NULL;
+			return false;
 		}
+		const bool notNA = ppTargets[i]->processString(pField, pFieldEnd - pField);
 
-		//if (hasHeaders)
-		listOfVectors.attr("names") = nameVec;
-
-		// Clean up threads
-		for (int i = 0 ; i < numThreads ; i++)
+		if (WithStats)
 		{
-			while (parserThreads[i]->IsRunning())
-				usleep(10);
-			delete parserThreads[i];
+			if (notNA)
+				pStats[i].addString(pField, pFieldEnd - pField);
+			else
+				pStats[i].addNA();
 		}
-#endif // !_WIN32
 	}
-
-	return listOfVectors;
+	return true;
 }
 
-//////////////////////////////////////////////////////////////////////////////
-
-bool ReadInputLine(FILE *fi, string &line)
+// Ignored fields only need to be counted, they don't have to be terminated
+bool SkipFields(ValueVector * const *ppTargets, ColumnStats *pStats, int numCols, char *&pPos, 
+                int &failedIdx, const char *&pFailedField)
 {
-	if (fi == 0)
-		return false;
-
-	vector<char> data;
-	bool gotchar = false;
-	int c;
-
-	while ((c = fgetc(fi)) != EOF)
+	for (int i = 0 ; i < numCols ; i++)
 	{
-		gotchar = true;
-		if (c == '\n') // stop here
-			break;
+		if (!pPos)
+		{
+			failedIdx = i;
+			pFailedField = NULL;
+			return false;
+		}
 
-		data.push_back((char)c);
+		char *pSep = strchr(pPos, ',');
+		pPos = (pSep)?(pSep + 1):NULL;
 	}
+	return true;
+}
 
-	if (!gotchar)
-		return false;
+// Separate kernels are used when statistics are gathered, so that parsing
+// without them doesn't pay for a check in every field
+template<bool WithStats>
+LineParser::FieldKernel LineParser::getKernel(ValueVector::VectorType t, ValueVector::VectorType columnType)
+{
+	if (t == ValueVector::Double && columnType == ValueVector::Integer)
+		return ParseFields<&ValueVector::processIntAsDouble, double, WithStats>;
 
-	size_t l = data.size();
-	if (l == 0)
-		line = "";
-	else
+	switch(t)
 	{
-		// Make sure it's null-terminated
-		if (data[l-1] == '\r')
-			data[l-1] = 0;
-		else
-			data.push_back(0);
-
-		line = string(&(data[0]));
+	case ValueVector::Ignore:
+		return SkipFields;
+	case ValueVector::Integer:
+		return ParseFields<&ValueVector::processInt, int, WithStats>;
+	case ValueVector::Logical:
+		return ParseFields<&ValueVector::processLogical, int, WithStats>;
+	case ValueVector::Double:
+		return ParseFields<&ValueVector::processDouble, double, WithStats>;
+	case ValueVector::Date:
+		return ParseFields<&ValueVector::processDate, double, WithStats>;
+	case ValueVector::DateTime:
+		return ParseFields<&ValueVector::processDateTime, double, WithStats>;
+	case ValueVector::String:
+		return StoreStrings<WithStats>;
+	default:
+		throw Rcpp::exception("Internal error: unknown column type in LineParser");
 	}
+}
 
-	return true;
+void ProblemList::add(int col, const char *pValue)
+{
+	m_total++;
+	if (m_maxProblems == 0)
+		return;
+
+	// A problem further in the file than the ones that are kept, is of no use
+	if (m_problems.size() >= m_maxProblems && m_sorted && m_chunkIdx >= m_problems[m_maxProblems-1].chunkIdx)
+		return;
+
+	Problem p;
+	p.fileIdx = 0;
+	p.col = col;
+	p.chunkIdx = 0;
+	p.line = 0;
+	p.missing = (pValue == 0);
+	if (pValue)
+		p.value = pValue;
+	m_problems.push_back(p);
 }
 
-bool HasCharacter(const string &charList, char c)
+void ProblemList::assignLine(int fileIdx, size_t chunkIdx, size_t line)
 {
-	for (int i = 0 ; i < charList.length() ; i++)
+	if (m_firstUnassigned > 0 && chunkIdx < m_problems[m_firstUnassigned-1].chunkIdx)
+		m_sorted = false;
+
+	for (size_t i = m_firstUnassigned ; i < m_problems.size() ; i++)
 	{
-		if (c == charList[i])
-			return true;
+		m_problems[i].fileIdx = fileIdx;
+		m_problems[i].chunkIdx = chunkIdx;
+		m_problems[i].line = line;
 	}
-	return false;
+	m_firstUnassigned = m_problems.size();
+
+	// Only every so often, so that the sorting doesn't happen for every line
+	if (m_problems.size() >= 2*m_maxProblems)
+		keepFirst();
 }
 
-void SplitLine(const string &line, vector<string> &args, const string &separatorChars,
-	       const string &quoteChars, const string &commentStartChars, bool ignoreZeroLengthFields)
+inline bool CompareChunkProblems(const Problem &a, const Problem &b)
 {
-	vector<string> arguments;
-	int startPos = 0;
+	if (a.chunkIdx != b.chunkIdx)
+		return a.chunkIdx < b.chunkIdx;
+	if (a.line != b.line)
+		return a.line < b.line;
+	return a.col < b.col;
+}
 
-	while (startPos < line.length() && HasCharacter(separatorChars, line[startPos]))
+void ProblemList::keepFirst()
+{
+	if (!m_sorted)
 	{
-		startPos++;
-
-		if (!ignoreZeroLengthFields)
-			arguments.push_back("");
+		std::sort(m_problems.begin(), m_problems.begin() + m_firstUnassigned, CompareChunkProblems);
+		m_sorted = true;
 	}
 
-	string curString("");
-	bool done = false;
-
-	if (startPos >= line.length())
+	if (m_firstUnassigned > m_maxProblems)
 	{
-		if (!ignoreZeroLengthFields)
-			arguments.push_back("");
+		m_problems.erase(m_problems.begin() + m_maxProblems, m_problems.begin() + m_firstUnassigned);
+		m_firstUnassigned = m_maxProblems;
 	}
+}
 
-	while (startPos < line.length() && !done)
-	{
-		int endPos = startPos;
-		bool endFound = false;
-		bool gotSeparator = false;
+ColumnStats::ColumnStats() 
+	: m_min(R_PosInf), m_max(R_NegInf), m_sum(0), m_numValues(0), m_numNA(0), m_maxLength(0), 
+	  m_registers(1 << s_registerBits, 0)
+{
+}
 
-		while (!endFound && endPos < line.length())
-		{
-			if (HasCharacter(separatorChars, line[endPos]) || HasCharacter(commentStartChars, line[endPos]))
-			{
-				curString += line.substr(startPos, endPos-startPos);
-				endFound = true;
+// Finalizer of splitmix64, spreads the bits of the value over the whole hash
+inline uint64_t ColumnStats::mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
 
-				if (HasCharacter(separatorChars, line[endPos]))
-				{
-					gotSeparator = true;
-					endPos++;
-				}
-			}
-			else if (HasCharacter(quoteChars, line[endPos]))
-			{
-				curString += line.substr(startPos, endPos-startPos);
+inline void ColumnStats::addHash(uint64_t h)
+{
+	// The first bits select the register, which keeps the largest position of
+	// the first set bit in the rest
+	const size_t idx = (size_t)(h >> (64 - s_registerBits));
+	uint64_t rest = h << s_registerBits;
+
+	uint8_t rank = 1;
+	while (rank <= 64 - s_registerBits && !(rest & 0x8000000000000000ULL))
+	{
+		rest <<= 1;
+		rank++;
+	}
 
-				char quoteStartChar = line[endPos];
+	if (rank > m_registers[idx])
+		m_registers[idx] = rank;
+}
 
-				endPos += 1;
-				startPos = endPos;
+inline void ColumnStats::add(int x)
+{
+	if (x == NA_INTEGER)
+	{
+		m_numNA++;
+		return;
+	}
 
-				while (endPos < line.length() && line[endPos] != quoteStartChar)
-					endPos++;
+	m_min = std::min(m_min, (double)x);
+	m_max = std::max(m_max, (double)x);
+	m_sum += x;
+	m_numValues++;
+	addHash(mix((uint64_t)(uint32_t)x));
+}
 
-				curString += line.substr(startPos, endPos-startPos);
+inline void ColumnStats::add(double x)
+{
+	if (ISNAN(x))
+	{
+		m_numNA++;
+		return;
+	}
 
-				if (endPos < line.length())
-					endPos++;
+	m_min = std::min(m_min, x);
+	m_max = std::max(m_max, x);
+	m_sum += x;
+	m_numValues++;
 
-				startPos = endPos;
-			}
-			else
-				endPos++;
-		}
+	if (x == 0) // Don't count -0 as a separate value
+		x = 0;
 
-		if (!endFound)
-		{
-			if (endPos-startPos > 0)
-				curString += line.substr(startPos, endPos-startPos);
-		}
+	uint64_t bits;
+	memcpy(&bits, &x, sizeof(double));
+	addHash(mix(bits));
+}
 
-		if (curString.length() > 0 || !ignoreZeroLengthFields)
-			arguments.push_back(curString);
+inline void ColumnStats::addString(const char *pStr, size_t len)
+{
+	// FNV-1a, 64 bit version
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0 ; i < len ; i++)
+	{
+		h ^= (unsigned char)pStr[i];
+		h *= 1099511628211ULL;
+	}
 
-		if (endPos < line.length() && HasCharacter(commentStartChars, line[endPos]))
-			done = true;
-		else
-		{
-			startPos = endPos;
-			curString = string("");
+	m_maxLength = std::max(m_maxLength, (int)len);
+	m_numValues++;
+	addHash(mix(h));
+}
 
+void ColumnStats::merge(const ColumnStats &other)
+{
+	m_min = std::min(m_min, other.m_min);
+	m_max = std::max(m_max, other.m_max);
+	m_sum += other.m_sum;
+	m_numValues += other.m_numValues;
+	m_numNA += other.m_numNA;
+	m_maxLength = std::max(m_maxLength, other.m_maxLength);
+
+	for (size_t i = 0 ; i < m_registers.size() ; i++)
+		m_registers[i] = std::max(m_registers[i], other.m_registers[i]);
+}
 
-			while (startPos < line.length() && HasCharacter(separatorChars, line[startPos]))
-			{
-				gotSeparator = true;
-				startPos++;
+double ColumnStats::estimateDistinct() const
+{
+	const double m = (double)m_registers.size();
+	double sum = 0;
+	int numZero = 0;
 
-				if (!ignoreZeroLengthFields)
-					arguments.push_back("");
-			}
-			
-			if (gotSeparator)
-			{
-				if (startPos >= line.length())
-				{
-					if (!ignoreZeroLengthFields)
-						arguments.push_back("");
-				}
-			}
-		}
+	for (size_t i = 0 ; i < m_registers.size() ; i++)
+	{
+		sum += ldexp(1.0, -(int)m_registers[i]);
+		if (m_registers[i] == 0)
+			numZero++;
 	}
 
-	args = arguments;
-}
+	const double alpha = 0.7213/(1.0 + 1.079/m);
+	double estimate = alpha*m*m/sum;
 
-ValueVector::ValueVector(VectorType t) : m_vectorType(t) 
-{ 
-}
+	// Linear counting is more accurate for small numbers of values
+	if (estimate <= 2.5*m && numZero > 0)
+		estimate = m*log(m/numZero);
 
-ValueVector::~ValueVector() 
-{ 
+	return std::min(floor(estimate + 0.5), (double)m_numValues);
 }
 
-void ValueVector::setType(VectorType t)
+LineParser::LineParser(const vector<ValueVector *> &targets, ProblemList *pProblems, ColumnStats *pStats,
+		       const vector<ValueVector> *pColumns) 
+	: m_targets(targets), m_pProblems(pProblems), m_pStats(pStats)
 {
-	if (m_vectorInt.size() || m_vectorDouble.size() || m_vectorString.size())
-		throw Rcpp::exception("Internal error: vectors should be empty when calling setType()");
+	for (size_t i = 0 ; i < m_targets.size() ; i++)
+	{
+		const ValueVector::VectorType t = m_targets[i]->getType();
+		const ValueVector::VectorType columnType = (pColumns)?(*pColumns)[i].getType():t;
+		const FieldKernel kernel = (pStats)?getKernel<true>(t, columnType):getKernel<false>(t, columnType);
 
-	m_vectorType = t;
+		if (m_plan.size() > 0 && kernel == m_plan.back().kernel)
+			m_plan.back().numCols++;
+		else
+			m_plan.push_back(ParseStep(kernel, (int)i));
+	}
 }
 
-bool ValueVector::processWithCheck(const char *pStr, bool lastCol)
-{ 
-	switch(m_vectorType)
-	{
-	case Ignore:
-		break;
-	case Integer:
-		int x;
-		if (!parseAsInt(pStr, x))
-			return false;
+bool LineParser::parse(char *pLine, size_t lineLength, int &failedCol, const char *&pFailedField)
+{
+	// Remove the \n or \r\n once, so that the last field doesn't need special treatment
+	while (lineLength > 0 && (pLine[lineLength-1] == '\n' || pLine[lineLength-1] == '\r'))
+		lineLength--;
+	pLine[lineLength] = 0;
 
-		m_vectorInt.push_back(x);
-		break;
-	case Double:
-		double y;
-		if (!parseAsDouble(pStr, y))
-			return false;
+	char *pPos = pLine;
+	ValueVector * const *ppTargets = &m_targets[0];
 
-		m_vectorDouble.push_back(y);
-		break;
-	case String:
-		if (lastCol) // Possibly ends with \n, \r\n
+	for (size_t s = 0 ; s < m_plan.size() ; s++)
+	{
+		const ParseStep &step = m_plan[s];
+		const int endCol = step.firstCol + step.numCols;
+		int col = step.firstCol;
+		int failedIdx;
+
+		while (!step.kernel(ppTargets + col, (m_pStats)?(m_pStats + col):0, endCol - col, pPos, failedIdx, pFailedField))
 		{
-			int len = strlen(pStr);
+			col += failedIdx;
+			if (!m_pProblems)
+			{
+				failedCol = col;
+				return false;
+			}
 
-			while (len > 0)
+			m_pProblems->add(col, pFailedField);
+			if (!pFailedField) // The rest of the line is missing
 			{
-				char c = pStr[len-1];
-				if (c == '\n' || c == '\r')
-				{
-					len--;
-				}
-				else
+				for (size_t i = col ; i < m_targets.size() ; i++)
 				{
-					break;
+					m_targets[i]->addNA();
+					if (m_pStats)
+						m_pStats[i].addNA();
 				}
+				return true;
 			}
-			m_vectorString.push_back(string(pStr, len));
-		}
-		else
-		{
-			m_vectorString.push_back(pStr);
+
+			m_targets[col]->addNA();
+			if (m_pStats)
+				m_pStats[col].addNA();
+			if (++col == endCol)
+				break;
 		}
-		break;
-	default:
-		throw Rcpp::exception("Internal error: unknown m_vectorType");
 	}
-
 	return true;
 }
 
-void ValueVector::addColumnToList(List &listOfVectors)
+#ifndef _WIN32
+void ParserThread::runThread()
 {
-	switch(m_vectorType)
+	const size_t maxLineBytes = (size_t)maxLineLength;
+	vector<char> buffer(maxLineBytes+1);
+	char *buff = &(buffer[0]);
+	size_t row = 0;
+	size_t chunkIdx;
+	size_t chunkBytesDone = 0;
+
+	const int chunkRange = threadPlacement.getRange(threadIdx);
+
+	// The sort key's digits are counted per chunk, with the value just parsed
+	SortKeyCounts keyCounts;
+	const bool intKey = (sortKeyCol >= 0 && (columnSpec[sortKeyCol] == 'i' || columnSpec[sortKeyCol] == 'l'));
+
+	while (!interrupt.load(std::memory_order_relaxed) && chunkQueue.getNext(chunkRange, chunkIdx))
 	{
-	case Ignore:
-		throw Rcpp::exception("Internal error: 'Ignore' should not be used in addColumnToList");
-	case Integer:
-		{
-			const int num = m_vectorInt.size();
-			IntegerVector v(num);
+		const Chunk &chunk = chunkQueue.chunks[chunkIdx];
+		const char *pStr = chunk.pStart;
+		const size_t firstRow = row;
 
-			for (int i = 0 ; i < num ; i++)
-				v[i] = m_vectorInt[i];
+		problems.startChunk(chunkIdx);
+		if (sortKeyCol >= 0)
+			keyCounts.reset();
 
-			listOfVectors.push_back(v);
-		}
-		break;
-	case Double:
+		while (pStr < chunk.pEnd && !interrupt.load(std::memory_order_relaxed))
 		{
-			const int num = m_vectorDouble.size();
-			NumericVector v(num);
+			const char *pNewLine = (const char *)memchr(pStr, '\n', chunk.pEnd - pStr);
+			const char *pNext = (pNewLine)?(pNewLine + 1):chunk.pEnd;
+			const size_t lineLen = std::min((size_t)(pNext - pStr), maxLineBytes);
 
-			for (int i = 0 ; i < num ; i++)
-				v[i] = m_vectorDouble[i];
+			memcpy(buff, pStr, lineLen);
+			buff[lineLen] = 0;
 
-			listOfVectors.push_back(v);
-		}
-		break;
-	case String:
-		{
-			const int num = m_vectorString.size();
-			StringVector v(num);
+			int failedCol;
+			const char *pFailedField;
+
+			if (!lineParser.parse(buff, lineLen, failedCol, pFailedField))
+			{
+				if (!pFailedField)
+					errorString = getString("Not enough columns on line %d of '%s'", chunk.lineNumber(pStr),
+					                        fileNames[chunk.fileIdx].c_str());
+				else
+					errorString = getString("Unable to interpret '%s' (file '%s', line %d, col %d) as type '%c'",
+						                pFailedField, fileNames[chunk.fileIdx].c_str(), chunk.lineNumber(pStr),
+								failedCol+1, columnSpec[failedCol]);
+				interrupt = true;
+				return;
+			}
 
-			for (int i = 0 ; i < num ; i++)
-				v[i] = m_vectorString[i];
+			if (problems.hasUnassigned())
+				problems.assignLine(chunk.fileIdx, chunkIdx, row - firstRow);
 
-			listOfVectors.push_back(v);
+			if (sortKeyCol >= 0)
+			{
+				const ValueVector &keyColumn = columns[sortKeyCol];
+				keyCounts.add((intKey)?GetSortKey(keyColumn.lastValue<int>()):GetSortKey(keyColumn.lastValue<double>()));
+			}
+
+			row++;
+			pStr = pNext;
+
+			if ((row & 0xFFF) == 0)
+				bytesDone.store(chunkBytesDone + (pStr - chunk.pStart), std::memory_order_relaxed);
 		}
-		break;
-	default:
-		throw Rcpp::exception("Internal error: unknown m_vectorType");
-	}
 
+		chunkResults.push_back(ChunkResult(chunkIdx, firstRow, row - firstRow));
+		if (sortKeyCol >= 0)
+			std::swap((*pSortKeyCounts)[chunkIdx], keyCounts);
+		chunkBytesDone += chunk.pEnd - chunk.pStart;
+		bytesDone.store(chunkBytesDone, std::memory_order_relaxed);
+	}
 }
 
-void ValueVector::addColumnToList(List &listOfVectors, int numThreads, int thread, int totalEntries)
+ThreadPlacement::ThreadPlacement(int numThreads, bool pin) : m_pin(false), m_numRanges(1), m_threadRange(numThreads, 0)
 {
-	// thread 0 should create the new vector, the other threads should use the last added vector
+#ifdef __linux__
+	if (!pin)
+		return;
+
+	vector<vector<int> > nodeCPUs = getNodeCPUs();
+	if (nodeCPUs.size() == 0)
+		return;
+
+	// Consecutive threads are placed on the same node, so that they work on
+	// neighbouring parts of the files
+	m_pin = true;
+	m_numRanges = std::min((int)nodeCPUs.size(), numThreads);
+	for (int t = 0 ; t < numThreads ; t++)
+		m_threadRange[t] = (int)(((size_t)t * m_numRanges)/numThreads);
+
+	m_rangeCPUs.assign(nodeCPUs.begin(), nodeCPUs.begin() + m_numRanges);
+#else
+	if (pin)
+		Rcerr << "Pinning threads is only supported on Linux, ignoring" << endl;
+#endif // __linux__
+}
 
-	switch(m_vectorType)
+// Parses a list like "0-7,16-23"
+bool ThreadPlacement::parseCPUList(const string &list, vector<int> &cpus)
+{
+	const char *pStr = list.c_str();
+	while (*pStr)
 	{
-	case Ignore:
-		throw Rcpp::exception("Internal error: 'Ignore' should not be used in addColumnToList");
-	case Integer:
+		char *pEnd;
+		long first = strtol(pStr, &pEnd, 10);
+		if (pEnd == pStr)
+			return false;
+
+		long last = first;
+		pStr = pEnd;
+		if (*pStr == '-')
 		{
-			if (thread == 0)
-				listOfVectors.push_back(IntegerVector(totalEntries));
+			pStr++;
+			last = strtol(pStr, &pEnd, 10);
+			if (pEnd == pStr || last < first)
+				return false;
+			pStr = pEnd;
+		}
 
-			IntegerVector v = listOfVectors[listOfVectors.size()-1];
+		for (long c = first ; c <= last ; c++)
+			cpus.push_back((int)c);
 
-			const int num = m_vectorInt.size();
-			int outPos = thread;
+		while (*pStr == ',' || isspace(*pStr))
+			pStr++;
+	}
+	return true;
+}
 
-			for (int i = 0 ; i < num ; i++, outPos += numThreads)
-				v[outPos] = m_vectorInt[i];
-		}
-		break;
-	case Double:
-		{
-			if (thread == 0)
-				listOfVectors.push_back(NumericVector(totalEntries));
+vector<vector<int> > ThreadPlacement::getNodeCPUs()
+{
+	vector<vector<int> > nodeCPUs;
+	for (int node = 0 ; ; node++)
+	{
+		string fileName = getString("/sys/devices/system/node/node%d/cpulist", node);
+		FILE *pFile = fopen(fileName.c_str(), "rt");
+		if (!pFile)
+			break;
 
-			NumericVector v = listOfVectors[listOfVectors.size()-1];
+		AutoCloseFile autoCloser(pFile);
+		string line;
+		vector<int> cpus;
 
-			const int num = m_vectorDouble.size();
-			int outPos = thread;
+		if (!ReadInputLine(pFile, line) || !parseCPUList(line, cpus))
+			return vector<vector<int> >();
 
-			for (int i = 0 ; i < num ; i++, outPos += numThreads)
-				v[outPos] = m_vectorDouble[i];
-		}
-		break;
-	case String:
-		{
-			if (thread == 0)
-				listOfVectors.push_back(StringVector(totalEntries));
+		// Nodes without CPUs (e.g. memory only) can't run threads
+		if (cpus.size() > 0)
+			nodeCPUs.push_back(cpus);
+	}
+	return nodeCPUs;
+}
 
-			StringVector v = listOfVectors[listOfVectors.size()-1];
+void ThreadPlacement::pinCurrentThread(int thread) const
+{
+#ifdef __linux__
+	if (!m_pin)
+		return;
+
+	const vector<int> &cpus = m_rangeCPUs[m_threadRange[thread]];
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	for (size_t i = 0 ; i < cpus.size() ; i++)
+	{
+		if (cpus[i] < CPU_SETSIZE)
+			CPU_SET(cpus[i], &cpuSet);
+	}
 
-			const int num = m_vectorString.size();
-			int outPos = thread;
+	// Failing to pin isn't an error, the thread just runs anywhere
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+#endif // __linux__
+}
 
-			for (int i = 0 ; i < num ; i++, outPos += numThreads)
-				v[outPos] = m_vectorString[i];
-		}
-		break;
-	default:
-		throw Rcpp::exception("Internal error: unknown m_vectorType in addColumnToList2");
+ChunkQueue::ChunkQueue(const vector<Chunk> &c, size_t begin, size_t end, int numRanges) 
+	: chunks(c), m_numRanges(numRanges), m_ranges(new Range[numRanges])
+{
+	for (int r = 0 ; r < numRanges ; r++)
+	{
+		m_ranges[r].next = begin + ((end - begin) * r)/numRanges;
+		m_ranges[r].end = begin + ((end - begin) * (r+1))/numRanges;
 	}
 }
 
-inline char *StrTok(char *pStr, char delim, char **pSavePtr)
+bool ChunkQueue::getNext(int range, size_t &idx)
 {
-	char *pStart = pStr;
-	if (pStr == 0)
-		pStart = *pSavePtr;
-
-	char *pPos = pStart;
-	while (1)
+	for (int i = 0 ; i < m_numRanges ; i++)
 	{
-		char c = *pPos;
+		Range &r = m_ranges[(range + i) % m_numRanges];
+		if (r.next.load(std::memory_order_relaxed) >= r.end)
+			continue;
 
-		if (c == delim)
-		{
-			*pPos = 0;
-			*pSavePtr = pPos+1;
-			return pStart;
-		}
-		if (c == '\0')
-		{
-			*pSavePtr = pPos;
-			if (pPos == pStart)
-				return NULL;
-			return pStart;
-		}
-		pPos++;
+		idx = r.next.fetch_add(1, std::memory_order_relaxed);
+		if (idx < r.end)
+			return true;
 	}
+	return false;
+}
 
-	return NULL; // won't get here
+ParserThread::ParserThread(int idx, const string &colSpec, const ColumnOptions &options, bool asMatrix, 
+			   ValueVector::VectorType matrixType, ChunkQueue &queue, const ThreadPlacement &placement,
+			   const vector<string> &fNames, int maxLen, bool errorsAsNA, size_t maxProblems, 
+			   size_t reserveRows, bool computeStats, int keyCol, vector<SortKeyCounts> *pKeyCounts,
+			   std::atomic<bool> &intr, ThreadCompletion &completion)
+	: threadIdx(idx), threadPlacement(placement), columns(CreateColumns(colSpec, options)), 
+	  matrixColumn(matrixType), problems(maxProblems), columnStats((computeStats)?colSpec.length():0),
+	  lineParser(GetParseTargets(columns, matrixColumn, asMatrix), (errorsAsNA)?(&problems):0,
+	             (computeStats)?(&columnStats[0]):0, &columns), 
+	  chunkQueue(queue), fileNames(fNames), maxLineLength(maxLen), reservedRows(reserveRows),
+	  columnSpec(colSpec), sortKeyCol(keyCol), pSortKeyCounts(pKeyCounts), interrupt(intr),
+	  threadCompletion(completion), bytesDone(0)
+{
 }
 
-#ifndef _WIN32
-void ParserThread::runThread()
+void ParserThread::run()
 {
-	vector<char> buffer(maxLineLength+1);
-	char *buff = &(buffer[0]);
+	// Pin before anything is allocated, so that the parsed values end up in
+	// memory of the thread's own node
+	threadPlacement.pinCurrentThread(threadIdx);
 
-	bool done = false;
-	for (int i = 0 ; i < threadNum ; i++) // skip a number of lines, so that each thread reads different lines
+	// An exception can't be allowed to leave the thread
+	try
 	{
-		pStr = gotoNextLine(pStr);
-		if (*pStr == '\0')
+		// Reserving here rather than in the constructor also means the pages are
+		// first touched by this thread
+		if (matrixColumn.ignore())
 		{
-			done = true;
-			break;
+			for (size_t i = 0 ; i < columns.size() ; i++)
+				columns[i].reserve(reservedRows);
+		}
+		else
+		{
+			const size_t numMatrixCols = columns.size() - std::count(columnSpec.begin(), columnSpec.end(), '.');
+			matrixColumn.reserve(reservedRows*numMatrixCols);
 		}
-		lineNumber++;
-	}
 
-	while (!done && !interrupt)
+		runThread();
+	}
+	catch (const std::exception &e)
 	{
-		char *pEnd = gotoNextLine(pStr);
-		size_t lineLen = pEnd - pStr;
+		errorString = e.what();
+		interrupt = true;
+	}
+	threadCompletion.threadDone();
+}
 
-		if (lineLen > maxLineLength)
-			lineLen = maxLineLength;
+// The block is allocated with room to move the object to the next cache line,
+// and the start of the block is kept just before the object
+void *ParserThread::operator new(size_t size)
+{
+	const size_t alignment = alignof(ParserThread);
+	void *pBlock = malloc(size + alignment + sizeof(void *));
+	if (!pBlock)
+		throw std::bad_alloc();
+
+	const uintptr_t addr = ((uintptr_t)pBlock + sizeof(void *) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	((void **)addr)[-1] = pBlock;
+	return (void *)addr;
+}
 
-		memcpy(buff, pStr, lineLen);
-		buff[lineLen] = 0;
+void ParserThread::operator delete(void *p)
+{
+	if (p)
+		free(((void **)p)[-1]);
+}
 
-		char *pBuff = buff;
-		char *pPtr = 0;
+size_t ParserThread::getMemoryUsage() const
+{
+	size_t usage = matrixColumn.getMemoryUsage();
+	for (size_t i = 0 ; i < columns.size() ; i++)
+		usage += columns[i].getMemoryUsage();
+	return usage;
+}
 
-		for (int i = 0 ; !done && i < numCols ; i++)
-		{
-			char *pPart = StrTok(pBuff, ',', &pPtr);
-			pBuff = 0;
+void ParserThread::copyChunks(const MergeInfo &info)
+{
+	threadPlacement.pinCurrentThread(threadIdx);
 
-			if (!pPart)
-			{
-				done = true;
-				errorString = getString("Not enough columns on line %d", lineNumber);
-				interrupt = true;
-				break;
-			}
+	// One column at a time, so that its staging memory can be freed as soon as
+	// it's been copied
+	for (size_t i = 0 ; i < info.columnData.size() ; i++)
+	{
+		if (!info.columnData[i])
+			continue;
 
-			int colNum = i+1;
-			if (!columns[i].processWithCheck(pPart, colNum == numCols))
-			{
-				done = true;
-				errorString= getString("Unable to interpret '%s' (line %d, col %d) as type '%c'",
-					               pPart, lineNumber, colNum, columnSpec[i]);
-				interrupt = true;
-			}
+		for (size_t r = 0 ; r < chunkResults.size() ; r++)
+		{
+			const size_t c = chunkResults[r].chunkIdx;
+			columns[i].copyToBuffer(info.columnData[i], info.chunkOutPos[c], info.chunkFirstRow[c], info.chunkRows[c]);
 		}
+		columns[i].release();
+	}
 
-		lineNumber++;
-
-		for (int i = 1 ; !done && i < numThreads ; i++) // skip threads-1 lines
+	if (info.pMatrixData)
+	{
+		for (size_t r = 0 ; r < chunkResults.size() ; r++)
 		{
-			pEnd = gotoNextLine(pEnd);
-			if (*pEnd == '\0')
-			{
-				done = true;
-				break;
-			}
-			lineNumber++;
+			const size_t c = chunkResults[r].chunkIdx;
+			matrixColumn.copyToMatrix(info.pMatrixData, info.totalRows, info.chunkOutPos[c], info.chunkFirstRow[c], 
+			                          info.chunkRows[c], info.numMatrixCols);
 		}
-		pStr = pEnd;
+		matrixColumn.release();
 	}
-
-	//Rcout << "Lines read: " << lineNumber << endl;
-}
-
-void *ParserThread::Thread()
-{
-	m_endMutex.Lock();
-	JThread::ThreadStarted();
-
-	runThread();
-	m_endMutex.Unlock();
-	return 0;
 }
 #endif // !_WIN32
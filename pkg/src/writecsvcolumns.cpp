@@ -0,0 +1,570 @@
+#include <Rcpp.h>
+#include <Rversion.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+using namespace std;
+using namespace Rcpp;
+
+// Defined in readcsvcolumns.cpp
+void Throw(const char *format, ...);
+string getString(const char *format, ...);
+bool UserInterruptPending();
+
+// A column as the writer threads see it: only pointers to the data, obtained
+// by the main thread, so that formatting doesn't need the R API
+struct OutputColumn
+{
+	OutputColumn() : type('.'), pInt(0), pDouble(0), pStrings(0) { }
+
+	char type;
+	const int *pInt;
+	const double *pDouble;
+	const SEXP *pStrings;
+};
+
+// Appends text to a buffer that's reused for every chunk, so that after the
+// first few chunks no more allocations are needed
+class TextBuffer
+{
+public:
+	TextBuffer() : m_size(0)					{ }
+
+	void clear()							{ m_size = 0; }
+	size_t size() const						{ return m_size; }
+	const char *data() const					{ return m_data.data(); }
+
+	// Returns room for at least 'len' more characters, commit() them afterwards
+	char *reserve(size_t len)
+	{
+		if (m_size + len > m_data.size())
+			m_data.resize(std::max(m_data.size()*2, m_size + len + 4096));
+		return &m_data[m_size];
+	}
+	void commit(size_t len)						{ m_size += len; }
+
+	void append(const char *pStr, size_t len)			{ memcpy(reserve(len), pStr, len); m_size += len; }
+	void append(char c)						{ *reserve(1) = c; m_size++; }
+private:
+	vector<char> m_data;
+	size_t m_size;
+};
+
+static const char s_digitPairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+// Writes the digits of x two at a time, from the back of a small buffer
+inline size_t FormatUnsigned(uint64_t x, char *pEnd)
+{
+	char *p = pEnd;
+	while (x >= 100)
+	{
+		const unsigned int i = (unsigned int)(x % 100)*2;
+		x /= 100;
+		*--p = s_digitPairs[i+1];
+		*--p = s_digitPairs[i];
+	}
+	if (x >= 10)
+	{
+		const unsigned int i = (unsigned int)x*2;
+		*--p = s_digitPairs[i+1];
+		*--p = s_digitPairs[i];
+	}
+	else
+		*--p = (char)('0' + x);
+	return pEnd - p;
+}
+
+inline void AppendInteger(TextBuffer &buffer, int64_t x)
+{
+	char tmp[24];
+	char *pEnd = tmp + sizeof(tmp);
+	const uint64_t absValue = (x < 0)?(uint64_t)(-(x + 1)) + 1:(uint64_t)x;
+
+	size_t len = FormatUnsigned(absValue, pEnd);
+	if (x < 0)
+		tmp[sizeof(tmp) - ++len] = '-';
+
+	buffer.append(pEnd - len, len);
+}
+
+// Writes exactly 'num' digits, with leading zeros
+inline void AppendFixedDigits(TextBuffer &buffer, int x, int num)
+{
+	char *p = buffer.reserve(num);
+	for (int i = num-1 ; i >= 0 ; i--)
+	{
+		p[i] = (char)('0' + x % 10);
+		x /= 10;
+	}
+	buffer.commit(num);
+}
+
+// The shortest of 15, 16 or 17 significant digits that reads back as the same
+// value. Values without a fractional part, which are very common, don't need
+// snprintf at all.
+inline void AppendDouble(TextBuffer &buffer, double x)
+{
+	if (x == floor(x) && fabs(x) < 1e15)
+	{
+		AppendInteger(buffer, (int64_t)x);
+		return;
+	}
+
+	if (ISNAN(x))
+	{
+		buffer.append("NaN", 3);
+		return;
+	}
+
+	if (std::isinf(x))
+	{
+		if (x < 0)
+			buffer.append("-Inf", 4);
+		else
+			buffer.append("Inf", 3);
+		return;
+	}
+
+	char *p = buffer.reserve(32);
+	int len = 0;
+	for (int precision = 15 ; precision <= 17 ; precision++)
+	{
+		len = snprintf(p, 32, "%.*g", precision, x);
+		if (precision == 17 || strtod(p, 0) == x)
+			break;
+	}
+	buffer.commit(len);
+}
+
+// Inverse of daysFromCivil in readcsvcolumns.cpp
+inline void CivilFromDays(int64_t z, int &y, int &m, int &d)
+{
+	z += 719468;
+	const int64_t era = ((z >= 0)?z:(z - 146096))/146097;
+	const int doe = (int)(z - era*146097);
+	const int yoe = (doe - doe/1460 + doe/36524 - doe/146096)/365;
+	const int doy = doe - (365*yoe + yoe/4 - yoe/100);
+	const int mp = (5*doy + 2)/153;
+
+	d = doy - (153*mp + 2)/5 + 1;
+	m = (mp < 10)?(mp + 3):(mp - 9);
+	y = (int)(yoe + era*400) + ((m <= 2)?1:0);
+}
+
+// The reader expects four digit years, i.e. from 0000-01-01 up to 9999-12-31
+inline bool IsWritableDay(int64_t days)
+{
+	return days >= -719528 && days <= 2932896;
+}
+
+// Rounds to microseconds, and splits that in days and the microseconds in that day
+inline void SplitDateTime(double seconds, int64_t &days, int64_t &rest)
+{
+	const int64_t microSeconds = (int64_t)floor(seconds*1e6 + 0.5);
+	const int64_t perDay = (int64_t)86400*1000000;
+	days = microSeconds/perDay;
+	rest = microSeconds % perDay;
+	if (rest < 0)
+	{
+		rest += perDay;
+		days--;
+	}
+}
+
+inline void AppendDate(TextBuffer &buffer, int64_t days)
+{
+	int y, m, d;
+	CivilFromDays(days, y, m, d);
+
+	AppendFixedDigits(buffer, y, 4);
+	buffer.append('-');
+	AppendFixedDigits(buffer, m, 2);
+	buffer.append('-');
+	AppendFixedDigits(buffer, d, 2);
+}
+
+// ISO-8601 in UTC, with as many fractional digits (up to microseconds) as needed
+inline void AppendDateTime(TextBuffer &buffer, double seconds)
+{
+	int64_t days, rest;
+	SplitDateTime(seconds, days, rest);
+
+	AppendDate(buffer, days);
+	buffer.append('T');
+
+	const int secs = (int)(rest/1000000);
+	int fraction = (int)(rest % 1000000);
+	AppendFixedDigits(buffer, secs/3600, 2);
+	buffer.append(':');
+	AppendFixedDigits(buffer, (secs/60) % 60, 2);
+	buffer.append(':');
+	AppendFixedDigits(buffer, secs % 60, 2);
+
+	if (fraction != 0)
+	{
+		int numDigits = 6;
+		while (fraction % 10 == 0)
+		{
+			fraction /= 10;
+			numDigits--;
+		}
+		buffer.append('.');
+		AppendFixedDigits(buffer, fraction, numDigits);
+	}
+	buffer.append('Z');
+}
+
+// The reader splits lines on every ',' and doesn't treat quotes specially, so
+// strings are written unchanged; the ones that can't be read back are refused
+// before anything is written
+inline bool IsWritableString(const char *pStr, size_t len)
+{
+	return !memchr(pStr, ',', len) && !memchr(pStr, '\n', len) && !memchr(pStr, '\r', len);
+}
+
+void FormatRows(const vector<OutputColumn> &columns, size_t firstRow, size_t numRows, const string &naString,
+		TextBuffer &buffer)
+{
+	buffer.clear();
+	for (size_t r = firstRow ; r < firstRow + numRows ; r++)
+	{
+		for (size_t c = 0 ; c < columns.size() ; c++)
+		{
+			if (c > 0)
+				buffer.append(',');
+
+			const OutputColumn &col = columns[c];
+			switch(col.type)
+			{
+			case 'i':
+				if (col.pInt[r] == NA_INTEGER)
+					buffer.append(naString.c_str(), naString.length());
+				else
+					AppendInteger(buffer, col.pInt[r]);
+				break;
+			case 'l':
+				if (col.pInt[r] == NA_LOGICAL)
+					buffer.append(naString.c_str(), naString.length());
+				else if (col.pInt[r])
+					buffer.append("TRUE", 4);
+				else
+					buffer.append("FALSE", 5);
+				break;
+			case 'r':
+			case 'd':
+			case 't':
+				if (R_IsNA(col.pDouble[r]) || (col.type != 'r' && !R_FINITE(col.pDouble[r])))
+					buffer.append(naString.c_str(), naString.length());
+				else if (col.type == 'r')
+					AppendDouble(buffer, col.pDouble[r]);
+				else if (col.type == 'd')
+					AppendDate(buffer, (int64_t)floor(col.pDouble[r]));
+				else
+					AppendDateTime(buffer, col.pDouble[r]);
+				break;
+			case 's':
+				{
+					SEXP s = col.pStrings[r];
+					if (s == NA_STRING)
+						buffer.append(naString.c_str(), naString.length());
+					else
+						buffer.append(CHAR(s), LENGTH(s));
+				}
+				break;
+			}
+		}
+		buffer.append('\n');
+	}
+}
+
+// The worker threads each format a chunk of rows at a time, and then wait for
+// their turn to write it, so that the chunks end up in the file in order while
+// at most one chunk per thread is kept in memory
+class ChunkWriter
+{
+public:
+	ChunkWriter(FILE *pFile, const string &fileName, const vector<OutputColumn> &columns, size_t numRows, 
+		    size_t chunkRows, const string &naString)
+		: m_pFile(pFile), m_fileName(fileName), m_columns(columns), m_numRows(numRows), m_chunkRows(chunkRows), m_naString(naString),
+		  m_nextChunk(0), m_nextToWrite(0), m_stop(false), m_running(0)
+	{
+		m_numChunks = (numRows + chunkRows - 1)/chunkRows;
+	}
+
+	void threadStarting()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running++;
+	}
+
+	void run()
+	{
+		TextBuffer buffer;
+		size_t chunk;
+
+		while (!m_stop && (chunk = m_nextChunk++) < m_numChunks)
+		{
+			const size_t firstRow = chunk*m_chunkRows;
+			FormatRows(m_columns, firstRow, std::min(m_chunkRows, m_numRows - firstRow), m_naString, buffer);
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this, chunk] { return m_nextToWrite == chunk || m_stop; });
+			if (m_stop)
+				break;
+
+			if (fwrite(buffer.data(), 1, buffer.size(), m_pFile) != buffer.size())
+			{
+				m_errorString = getString("Unable to write to file '%s'", m_fileName.c_str());
+				m_stop = true;
+			}
+			m_nextToWrite++;
+			m_condition.notify_all();
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running--;
+		m_condition.notify_all();
+	}
+
+	// Returns true if all threads are done
+	bool waitFor(int milliseconds)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_condition.wait_for(lock, std::chrono::milliseconds(milliseconds), [this] { return m_running == 0; });
+	}
+
+	void stop(const string &reason)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_errorString.length() == 0)
+			m_errorString = reason;
+		m_stop = true;
+		m_condition.notify_all();
+	}
+
+	const string &getErrorString() const				{ return m_errorString; }
+private:
+	FILE *m_pFile;
+	const string &m_fileName;
+	const vector<OutputColumn> &m_columns;
+	const size_t m_numRows, m_chunkRows;
+	size_t m_numChunks;
+	const string &m_naString;
+
+	std::atomic<size_t> m_nextChunk;
+	size_t m_nextToWrite;
+	std::atomic<bool> m_stop;
+	int m_running;
+	string m_errorString;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+};
+
+class AutoCloseOutputFile
+{
+public:
+	AutoCloseOutputFile(FILE *pFile) : m_pFile(pFile) 				{ }
+	~AutoCloseOutputFile() 								{ if (m_pFile) fclose(m_pFile); }
+
+	// Returns false if the buffered data couldn't be written
+	bool close()
+	{
+		FILE *pFile = m_pFile;
+		m_pFile = 0;
+		return fclose(pFile) == 0;
+	}
+private:
+	FILE *m_pFile;
+};
+
+// [[Rcpp::export]]
+SEXP WriteCSVColumns(List columns, string columnSpec, vector<string> names, string fileName, bool hasHeader,
+		     int numThreads, string naString)
+{
+	if (numThreads < 1)
+		Throw("Number of threads must be at least one");
+
+	if (columns.size() != (int)columnSpec.length() || names.size() != columnSpec.length())
+		Throw("Internal error: the number of columns, types and names differ");
+
+	if (columns.size() == 0)
+		Throw("There are no columns to write");
+
+	// Everything that needs the R API is done here, before the threads start
+	vector<OutputColumn> outputColumns(columns.size());
+	const size_t numRows = Rf_xlength(columns[0]);
+
+	for (size_t i = 0 ; i < outputColumns.size() ; i++)
+	{
+		SEXP column = columns[i];
+		OutputColumn &out = outputColumns[i];
+		out.type = columnSpec[i];
+
+		if ((size_t)Rf_xlength(column) != numRows)
+			Throw("Column '%s' has %d values instead of %d", names[i].c_str(), (int)Rf_xlength(column), (int)numRows);
+
+		SEXPTYPE expected = NILSXP;
+		switch(out.type)
+		{
+		case 'i':
+			expected = INTSXP;
+			break;
+		case 'l':
+			expected = LGLSXP;
+			break;
+		case 'r':
+		case 'd':
+		case 't':
+			expected = REALSXP;
+			break;
+		case 's':
+			expected = STRSXP;
+			break;
+		default:
+			Throw("Invalid column type '%c'", out.type);
+		}
+
+		if (TYPEOF(column) != expected)
+			Throw("Column '%s' doesn't have the storage type needed for type '%c'", names[i].c_str(), out.type);
+
+		if (expected == INTSXP)
+			out.pInt = INTEGER(column);
+		else if (expected == LGLSXP)
+			out.pInt = LOGICAL(column);
+		else if (expected == REALSXP)
+		{
+			out.pDouble = REAL(column);
+			for (size_t r = 0 ; out.type != 'r' && r < numRows ; r++)
+			{
+				const double x = out.pDouble[r];
+				if (!R_FINITE(x)) // written as NA
+					continue;
+
+				// A first check in doubles, so that the conversion can't overflow
+				const double perDay = (out.type == 'd')?1.0:86400.0;
+				bool writable = (x >= -719529*perDay && x <= 2932897*perDay);
+				if (writable)
+				{
+					int64_t days = (int64_t)floor(x), rest;
+					if (out.type == 't')
+						SplitDateTime(x, days, rest);
+					writable = IsWritableDay(days);
+				}
+
+				if (!writable)
+					Throw("Column '%s' has a date outside of the years 0 to 9999 on row %d, which can't be read back", names[i].c_str(), (int)(r+1));
+			}
+		}
+		else
+		{
+#if defined(R_VERSION) && R_VERSION >= R_Version(3, 5, 0)
+			out.pStrings = STRING_PTR_RO(column);
+#else
+			out.pStrings = STRING_PTR(column);
+#endif
+			for (size_t r = 0 ; r < numRows ; r++)
+			{
+				SEXP s = out.pStrings[r];
+				if (s != NA_STRING && !IsWritableString(CHAR(s), LENGTH(s)))
+					Throw("Column '%s' has a value containing a comma or line break on row %d, which can't be read back", names[i].c_str(), (int)(r+1));
+			}
+		}
+	}
+
+	if (hasHeader)
+	{
+		for (size_t i = 0 ; i < names.size() ; i++)
+			if (!IsWritableString(names[i].c_str(), names[i].length()))
+				Throw("Column name '%s' contains a comma or line break", names[i].c_str());
+	}
+
+	FILE *pFile = fopen(fileName.c_str(), "wb");
+	if (!pFile)
+		Throw("Unable to open file '%s' for writing", fileName.c_str());
+
+	AutoCloseOutputFile autoCloser(pFile);
+
+	if (hasHeader)
+	{
+		TextBuffer header;
+		for (size_t i = 0 ; i < names.size() ; i++)
+		{
+			if (i > 0)
+				header.append(',');
+			header.append(names[i].c_str(), names[i].length());
+		}
+		header.append('\n');
+
+		if (fwrite(header.data(), 1, header.size(), pFile) != header.size())
+			Throw("Unable to write to file '%s'", fileName.c_str());
+	}
+
+	// Chunks of about a megabyte keep the writes large, with some chunks per
+	// thread to keep the threads busy
+	const size_t chunkRows = std::max((size_t)1, std::min((size_t)1000000/(8*outputColumns.size() + 1),
+							      numRows/(numThreads*4) + 1));
+
+	if (numThreads == 1)
+	{
+		// The same code, without the threads: interrupts are checked between chunks
+		TextBuffer buffer;
+		for (size_t firstRow = 0 ; firstRow < numRows ; firstRow += chunkRows)
+		{
+			if (UserInterruptPending())
+				Throw("Writing was interrupted by the user");
+
+			FormatRows(outputColumns, firstRow, std::min(chunkRows, numRows - firstRow), naString, buffer);
+			if (fwrite(buffer.data(), 1, buffer.size(), pFile) != buffer.size())
+				Throw("Unable to write to file '%s'", fileName.c_str());
+		}
+	}
+	else
+	{
+		ChunkWriter writer(pFile, fileName, outputColumns, numRows, chunkRows, naString);
+		vector<std::thread> threads;
+		try
+		{
+			for (int i = 0 ; i < numThreads ; i++)
+			{
+				writer.threadStarting();
+				threads.push_back(std::thread(&ChunkWriter::run, &writer));
+			}
+		}
+		catch (const std::exception &e)
+		{
+			// The threads that did start will write all chunks
+			writer.run(); // Counts as the thread that couldn't be started
+		}
+
+		while (!writer.waitFor(100))
+		{
+			if (UserInterruptPending())
+				writer.stop("Writing was interrupted by the user");
+		}
+
+		for (size_t i = 0 ; i < threads.size() ; i++)
+			threads[i].join();
+
+		if (writer.getErrorString().length() > 0)
+			Throw("%s", writer.getErrorString().c_str());
+	}
+
+	if (!autoCloser.close())
+		Throw("Unable to write to file '%s'", fileName.c_str());
+
+	return R_NilValue;
+}